@@ -0,0 +1,225 @@
+# Offline viewer for the -binary output of the proj0 clients (drcctlib_binary_profile.h).
+# The file is mmapped, records and CCT nodes are found by binary search on the handle,
+# so only the contexts that are shown get decoded and symbolized.
+#
+#   python3 binary_profile_view.py instr_analysis.bin                 report in the client's text layout
+#   python3 binary_profile_view.py instr_analysis.bin -n 50           top 50 per metric
+#   python3 binary_profile_view.py instr_analysis.bin flat            one line per context
+#   python3 binary_profile_view.py instr_analysis.bin folded -m 1     folded stacks for flamegraph.pl
+#   python3 binary_profile_view.py instr_analysis.bin context 1234    counters and backtrace of a handle
+#
+# Symbols come from addr2line on the module the pc falls into. The instruction text of
+# the online report is not stored, that column stays empty.
+
+import bisect, heapq, mmap, struct, subprocess, sys
+
+HEADER = struct.Struct( "<8sIIIIQQQQQQQQQ" )
+RECORD = struct.Struct( "<iI" )
+CCT_NODE = struct.Struct( "<iiQ" )
+MODULE = struct.Struct( "<QQQ" )
+SEPARATOR = "=" * 80
+
+class BinaryProfile( object ):
+	def __init__(self, path):
+		f = open( path, "rb" )
+		self.buf = mmap.mmap( f.fileno( ), 0, access=mmap.ACCESS_READ )
+		( magic, version, self.metric_num, self.sample_burst, self.sample_period,
+			self.pid, self.record_num, self.record_offset, self.cct_num, self.cct_offset,
+			self.module_num, self.module_offset, self.string_size,
+			self.string_offset ) = HEADER.unpack_from( self.buf, 0 )
+		if magic.rstrip( b"\0" ) != b"DRCCTBP" or version != 1:
+			sys.exit( "%s is not a version 1 binary profile" % path )
+		self.record_size = RECORD.size + 8 * self.metric_num
+		self.metrics = struct.Struct( "<%dQ" % self.metric_num )
+
+		strings = self.buf[ self.string_offset : self.string_offset + self.string_size ]
+		self.metric_names = [ s.decode( ) for s in strings.split( b"\0" )[ : self.metric_num ] ]
+		self.modules = [ ]
+		for i in range( self.module_num ):
+			start, end, path_offset = MODULE.unpack_from( self.buf, self.module_offset + i * MODULE.size )
+			path = strings[ path_offset : strings.index( b"\0", path_offset ) ].decode( )
+			self.modules.append( ( start, end, path ) )
+		self.modules.sort( )
+		self.module_starts = [ m[ 0 ] for m in self.modules ]
+		self.symbols = { }
+
+	# (handle, counters) of record i
+	def record(self, i):
+		offset = self.record_offset + i * self.record_size
+		handle, _ = RECORD.unpack_from( self.buf, offset )
+		return handle, self.metrics.unpack_from( self.buf, offset + RECORD.size )
+
+	def records(self):
+		for i in range( self.record_num ):
+			yield self.record( i )
+
+	def find_record(self, handle):
+		lo, hi = 0, self.record_num
+		while lo < hi:
+			mid = ( lo + hi ) // 2
+			h, _ = RECORD.unpack_from( self.buf, self.record_offset + mid * self.record_size )
+			if h < handle:
+				lo = mid + 1
+			else:
+				hi = mid
+		if lo < self.record_num:
+			h, counters = self.record( lo )
+			if h == handle:
+				return counters
+		return None
+
+	# (parent, pc) of a handle, None if it is not in the file
+	def find_node(self, handle):
+		lo, hi = 0, self.cct_num
+		while lo < hi:
+			mid = ( lo + hi ) // 2
+			h, parent, pc = CCT_NODE.unpack_from( self.buf, self.cct_offset + mid * CCT_NODE.size )
+			if h == handle:
+				return parent, pc
+			if h < handle:
+				lo = mid + 1
+			else:
+				hi = mid
+		return None
+
+	def backtrace(self, handle):
+		frames = [ ]
+		while handle > 0:
+			node = self.find_node( handle )
+			if node is None:
+				break
+			frames.append( ( handle, node[ 1 ] ) )
+			handle = node[ 0 ]
+		self.symbolize( [ pc for _, pc in frames ] )
+		return frames
+
+	# fills self.symbols with (function, line, file), one addr2line run per module
+	def symbolize(self, pcs):
+		by_module = { }
+		for pc in pcs:
+			if pc in self.symbols:
+				continue
+			i = bisect.bisect_right( self.module_starts, pc ) - 1
+			if pc == 0 or i < 0 or pc >= self.modules[ i ][ 1 ] or not self.modules[ i ][ 2 ]:
+				self.symbols[ pc ] = ( "??", 0, "" )
+				continue
+			by_module.setdefault( i, [ ] ).append( pc )
+		for i, module_pcs in by_module.items( ):
+			start, _, path = self.modules[ i ]
+			try:
+				out = subprocess.run( [ "addr2line", "-f", "-C", "-e", path ] +
+					[ hex( pc - start ) for pc in module_pcs ],
+					stdout=subprocess.PIPE, stderr=subprocess.DEVNULL ).stdout.decode( ).split( "\n" )
+			except OSError:
+				out = [ ]
+			for j, pc in enumerate( module_pcs ):
+				func = out[ 2 * j ] if 2 * j + 1 < len( out ) else "??"
+				location = out[ 2 * j + 1 ] if 2 * j + 1 < len( out ) else "??:0"
+				file, _, line = location.rpartition( ":" )
+				line = line.split( " " )[ 0 ]
+				self.symbols[ pc ] = ( func, int( line ) if line.isdigit( ) else 0,
+					file if file != "??" else "" )
+
+	# one backtrace line in the layout of drcctlib_print_backtrace, without the asm
+	def frame_text(self, handle, pc):
+		if pc == 0:
+			return "ROOT_CTXT[%d](0):\"(0x%016x) \"[ ]" % ( handle, pc )
+		func, line, file = self.symbols[ pc ]
+		return "%s(%d):\"(0x%016x)\"[%s]" % ( func, line, pc, file )
+
+	def top(self, metric, n):
+		return heapq.nlargest( n, ( ( counters[ metric ], -handle, handle ) for handle, counters in self.records( ) ) )
+
+def print_sampling(profile):
+	if profile.sample_period > 1:
+		print( "SAMPLING %d/%d, COUNTS ARE ESTIMATES\n" % ( profile.sample_burst, profile.sample_period ) )
+
+def view_text(profile, n):
+	print_sampling( profile )
+	if profile.metric_names == [ "EXECUTION TIMES" ]:
+		# instr_statistics_clean_call layout
+		for k, ( count, _, handle ) in enumerate( profile.top( 0, n ) ):
+			frames = profile.backtrace( handle )
+			print( "NO. %d PC %s=>EXECUTION TIMES\n%d\n=>BACKTRACE" % ( k + 1,
+				profile.frame_text( *frames[ 0 ] ) if frames else "", count ) )
+			for frame in frames:
+				print( profile.frame_text( *frame ) )
+			print( "\n\n" )
+		return
+	# drcctlib_instr_analysis layout
+	totals = [ 0 ] * profile.metric_num
+	for _, counters in profile.records( ):
+		for m in range( profile.metric_num ):
+			totals[ m ] += counters[ m ]
+	for m in range( profile.metric_num ):
+		print( "%s : %d" % ( profile.metric_names[ m ], totals[ m ] ) )
+		for k, ( count, _, handle ) in enumerate( profile.top( m, n ) ):
+			if count == 0:
+				break
+			print( "[NO. %d]Ins call times %d" % ( k + 1, count ) )
+			print( SEPARATOR )
+			for frame in profile.backtrace( handle ):
+				print( profile.frame_text( *frame ) )
+			print( SEPARATOR + "\n" )
+
+def view_flat(profile):
+	print( "HANDLE " + " ".join( name.replace( " ", "_" ) for name in profile.metric_names ) + " PC" )
+	rows = sorted( profile.records( ), key=lambda r: ( -r[ 1 ][ 0 ], r[ 0 ] ) )
+	leaves = { handle: profile.find_node( handle ) for handle, _ in rows }
+	profile.symbolize( [ node[ 1 ] for node in leaves.values( ) if node is not None ] )
+	for handle, counters in rows:
+		node = leaves[ handle ]
+		leaf = profile.frame_text( handle, node[ 1 ] ) if node is not None else ""
+		print( "%d %s %s" % ( handle, " ".join( str( c ) for c in counters ), leaf ) )
+
+def view_folded(profile, metric):
+	# every record is printed, so symbolize all CCT nodes in one batch per module
+	profile.symbolize( [ CCT_NODE.unpack_from( profile.buf, profile.cct_offset + i * CCT_NODE.size )[ 2 ]
+		for i in range( profile.cct_num ) ] )
+	for handle, counters in profile.records( ):
+		if counters[ metric ] == 0:
+			continue
+		frames = profile.backtrace( handle )
+		names = [ profile.symbols[ pc ][ 0 ] if pc else "ROOT" for _, pc in reversed( frames ) ]
+		print( "%s %d" % ( ";".join( names ), counters[ metric ] ) )
+
+def view_context(profile, handle):
+	counters = profile.find_record( handle )
+	if counters is None:
+		sys.exit( "no counters for context %d" % handle )
+	print_sampling( profile )
+	for m in range( profile.metric_num ):
+		print( "%s : %d" % ( profile.metric_names[ m ], counters[ m ] ) )
+	print( SEPARATOR )
+	for frame in profile.backtrace( handle ):
+		print( profile.frame_text( *frame ) )
+	print( SEPARATOR )
+
+def main( ):
+	args = sys.argv[ 1: ]
+	n = 10
+	metric = 0
+	if "-n" in args:
+		i = args.index( "-n" )
+		n = int( args[ i + 1 ] )
+		del args[ i : i + 2 ]
+	if "-m" in args:
+		i = args.index( "-m" )
+		metric = int( args[ i + 1 ] )
+		del args[ i : i + 2 ]
+	if not args:
+		sys.exit( "usage: binary_profile_view.py <profile> [text|flat|folded|context <handle>] [-n N] [-m METRIC]" )
+	profile = BinaryProfile( args[ 0 ] )
+	view = args[ 1 ] if len( args ) > 1 else "text"
+	if view == "text":
+		view_text( profile, n )
+	elif view == "flat":
+		view_flat( profile )
+	elif view == "folded":
+		view_folded( profile, metric )
+	elif view == "context" and len( args ) > 2:
+		view_context( profile, int( args[ 2 ] ) )
+	else:
+		sys.exit( "unknown view %s" % view )
+
+main( )
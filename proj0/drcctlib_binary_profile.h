@@ -0,0 +1,214 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_binary_profile.h
+ *
+ * Compact binary exit report of the proj0 clients. Instead of printing a backtrace per
+ * reported context, the client dumps the raw counters, the part of the CCT they hang
+ * off and the module list, and binary_profile_view.py symbolizes and renders them
+ * offline. The file is built in memory and written with one dr_write_file.
+ *
+ * Layout, little-endian, every section 8 byte aligned so the file can be mmapped and
+ * used in place:
+ *
+ *      binary_profile_header_t
+ *      record_num x (binary_profile_record_t + metric_num x uint64_t), by handle
+ *      cct_num    x binary_profile_cct_node_t, by handle, every ancestor of a record
+ *      module_num x binary_profile_module_t
+ *      strings: metric_num metric names, then the module paths, NUL terminated
+ */
+
+#ifndef _DRCCTLIB_BINARY_PROFILE_H_
+#define _DRCCTLIB_BINARY_PROFILE_H_
+
+#include <string.h>
+
+#include "dr_api.h"
+#include "drcctlib.h"
+#include "drcctlib_paged_table.h"
+
+#define BINARY_PROFILE_MAGIC "DRCCTBP"
+#define BINARY_PROFILE_VERSION 1
+
+typedef struct _binary_profile_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t metric_num;
+    // counts are already scaled, these only document the sampling rate
+    uint32_t sample_burst;
+    uint32_t sample_period;
+    uint64_t pid;
+    uint64_t record_num;
+    uint64_t record_offset;
+    uint64_t cct_num;
+    uint64_t cct_offset;
+    uint64_t module_num;
+    uint64_t module_offset;
+    uint64_t string_size;
+    uint64_t string_offset;
+} binary_profile_header_t;
+
+// followed by metric_num uint64_t counters
+typedef struct _binary_profile_record_t {
+    context_handle_t handle;
+    uint32_t reserved;
+} binary_profile_record_t;
+
+typedef struct _binary_profile_cct_node_t {
+    context_handle_t handle;
+    // 0 for a root
+    context_handle_t parent;
+    uint64_t pc;
+} binary_profile_cct_node_t;
+
+typedef struct _binary_profile_module_t {
+    uint64_t start;
+    uint64_t end;
+    // into the string section
+    uint64_t path_offset;
+} binary_profile_module_t;
+
+#define BINARY_PROFILE_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+// some modules, e.g. [vdso], have no path
+static inline const char *
+binary_profile_module_path(const module_data_t *module)
+{
+    return module->full_path == NULL ? "" : module->full_path;
+}
+
+// Writes the contexts of table for which get_metrics(entry, metrics) returns true.
+// get_metrics fills metric_num counters. Returns false if the file could not be
+// written.
+template <typename T, typename F>
+static bool
+binary_profile_write(const char *path, paged_table_t<T> &table,
+                     context_handle_t max_ctxt_hndl, int32_t metric_num,
+                     const char *const *metric_names, int32_t sample_burst,
+                     int32_t sample_period, F get_metrics)
+{
+    uint64_t *metrics = (uint64_t *)dr_global_alloc(metric_num * sizeof(uint64_t));
+
+    // pass 1: count the records and mark them and their ancestors
+    paged_table_t<uint8_t> in_cct;
+    if (!in_cct.init(false)) {
+        dr_global_free(metrics, metric_num * sizeof(uint64_t));
+        return false;
+    }
+    uint64_t record_num = 0;
+    uint64_t cct_num = 0;
+    paged_table_for_each(table, max_ctxt_hndl, [&](context_handle_t i, T &entry) {
+        if (!get_metrics(entry, metrics)) {
+            return;
+        }
+        record_num++;
+        for (context_handle_t h = i; h > 0 && in_cct.get(h) == 0;
+             h = drcctlib_get_caller_handle(h)) {
+            in_cct.get(h) = 1;
+            cct_num++;
+        }
+    });
+
+    uint64_t module_num = 0;
+    size_t string_size = 0;
+    for (int32_t m = 0; m < metric_num; m++) {
+        string_size += strlen(metric_names[m]) + 1;
+    }
+    dr_module_iterator_t iter = dr_module_iterator_start();
+    while (dr_module_iterator_hasnext(iter)) {
+        module_data_t *module = dr_module_iterator_next(iter);
+        module_num++;
+        string_size += strlen(binary_profile_module_path(module)) + 1;
+        dr_free_module_data(module);
+    }
+    dr_module_iterator_stop(iter);
+
+    binary_profile_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_PROFILE_MAGIC, sizeof(BINARY_PROFILE_MAGIC));
+    header.version = BINARY_PROFILE_VERSION;
+    header.metric_num = metric_num;
+    header.sample_burst = sample_burst;
+    header.sample_period = sample_period;
+    header.pid = dr_get_process_id();
+    size_t record_size = sizeof(binary_profile_record_t) + metric_num * sizeof(uint64_t);
+    header.record_num = record_num;
+    header.record_offset = BINARY_PROFILE_ALIGN(sizeof(header));
+    header.cct_num = cct_num;
+    header.cct_offset = header.record_offset + record_num * record_size;
+    header.module_num = module_num;
+    header.module_offset = header.cct_offset + cct_num * sizeof(binary_profile_cct_node_t);
+    header.string_size = string_size;
+    header.string_offset =
+        header.module_offset + module_num * sizeof(binary_profile_module_t);
+    size_t file_size = BINARY_PROFILE_ALIGN(header.string_offset + string_size);
+
+    byte *buf = (byte *)dr_raw_mem_alloc(file_size, DR_MEMPROT_READ | DR_MEMPROT_WRITE,
+                                         NULL);
+    if (buf == NULL) {
+        in_cct.free();
+        dr_global_free(metrics, metric_num * sizeof(uint64_t));
+        return false;
+    }
+    memset(buf, 0, file_size);
+    memcpy(buf, &header, sizeof(header));
+
+    // pass 2: records and CCT nodes, both in handle order
+    byte *record = buf + header.record_offset;
+    paged_table_for_each(table, max_ctxt_hndl, [&](context_handle_t i, T &entry) {
+        if (!get_metrics(entry, (uint64_t *)(record + sizeof(binary_profile_record_t)))) {
+            return;
+        }
+        ((binary_profile_record_t *)record)->handle = i;
+        record += record_size;
+    });
+    binary_profile_cct_node_t *node = (binary_profile_cct_node_t *)(buf + header.cct_offset);
+    paged_table_for_each(in_cct, max_ctxt_hndl, [&](context_handle_t i, uint8_t &mark) {
+        if (mark == 0) {
+            return;
+        }
+        node->handle = i;
+        node->parent = drcctlib_get_caller_handle(i);
+        node->pc = (uint64_t)drcctlib_get_pc(i);
+        node++;
+    });
+
+    char *strings = (char *)(buf + header.string_offset);
+    size_t string_pos = 0;
+    for (int32_t m = 0; m < metric_num; m++) {
+        strcpy(strings + string_pos, metric_names[m]);
+        string_pos += strlen(metric_names[m]) + 1;
+    }
+    // the process is exiting, so the module list is the one counted above
+    binary_profile_module_t *module_entry =
+        (binary_profile_module_t *)(buf + header.module_offset);
+    iter = dr_module_iterator_start();
+    for (uint64_t m = 0; m < module_num && dr_module_iterator_hasnext(iter); m++) {
+        module_data_t *module = dr_module_iterator_next(iter);
+        const char *module_path = binary_profile_module_path(module);
+        module_entry->start = (uint64_t)module->start;
+        module_entry->end = (uint64_t)module->end;
+        module_entry->path_offset = string_pos;
+        strcpy(strings + string_pos, module_path);
+        string_pos += strlen(module_path) + 1;
+        module_entry++;
+        dr_free_module_data(module);
+    }
+    dr_module_iterator_stop(iter);
+
+    bool ok = false;
+    file_t file = dr_open_file(path, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+    if (file != INVALID_FILE) {
+        ok = dr_write_file(file, buf, file_size) == (ssize_t)file_size;
+        dr_close_file(file);
+    }
+    dr_raw_mem_free(buf, file_size);
+    in_cct.free();
+    dr_global_free(metrics, metric_num * sizeof(uint64_t));
+    return ok;
+}
+
+#endif // _DRCCTLIB_BINARY_PROFILE_H_
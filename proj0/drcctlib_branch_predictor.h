@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_branch_predictor.h
+ *
+ * Two textbook direction predictors for the proj0 clients, run side by side on the
+ * same branch stream:
+ *
+ *  bimodal  2-bit saturating counters indexed by the branch address
+ *  gshare   2-bit saturating counters indexed by the address xor the global history
+ *           of the last BRANCH_PREDICTOR_HISTORY_BITS directions
+ *
+ * A branch that gshare still mispredicts often depends on data rather than on the
+ * path to it. Counters start weakly not taken. Not thread safe, the clients keep one
+ * instance per thread, so the history is per thread like in hardware.
+ */
+
+#ifndef _DRCCTLIB_BRANCH_PREDICTOR_H_
+#define _DRCCTLIB_BRANCH_PREDICTOR_H_
+
+#include <string.h>
+
+#include "dr_api.h"
+
+#define BRANCH_PREDICTOR_TABLE_BITS 12
+#define BRANCH_PREDICTOR_TABLE_SIZE (1 << BRANCH_PREDICTOR_TABLE_BITS)
+#define BRANCH_PREDICTOR_HISTORY_BITS 12
+
+struct branch_predictor_t {
+    uint8_t bimodal[BRANCH_PREDICTOR_TABLE_SIZE];
+    uint8_t gshare[BRANCH_PREDICTOR_TABLE_SIZE];
+    uint32_t history;
+
+    void
+    init()
+    {
+        memset(bimodal, 1, sizeof(bimodal));
+        memset(gshare, 1, sizeof(gshare));
+        history = 0;
+    }
+
+    // Predicts and trains both tables on one executed branch, the return bits say
+    // which predictor missed: 1 bimodal, 2 gshare.
+    inline int32_t
+    update(app_pc pc, bool taken)
+    {
+        // x86 branches are at least 2 bytes apart most of the time
+        uint32_t pc_bits = (uint32_t)((ptr_uint_t)pc >> 1);
+        uint32_t bimodal_idx = pc_bits & (BRANCH_PREDICTOR_TABLE_SIZE - 1);
+        uint32_t gshare_idx = (pc_bits ^ history) & (BRANCH_PREDICTOR_TABLE_SIZE - 1);
+        int32_t missed = 0;
+        if ((bimodal[bimodal_idx] >= 2) != taken) {
+            missed |= 1;
+        }
+        if ((gshare[gshare_idx] >= 2) != taken) {
+            missed |= 2;
+        }
+        train(bimodal[bimodal_idx], taken);
+        train(gshare[gshare_idx], taken);
+        history = ((history << 1) | (taken ? 1 : 0)) &
+            ((1 << BRANCH_PREDICTOR_HISTORY_BITS) - 1);
+        return missed;
+    }
+
+private:
+    static inline void
+    train(uint8_t &counter, bool taken)
+    {
+        if (taken && counter < 3) {
+            counter++;
+        } else if (!taken && counter > 0) {
+            counter--;
+        }
+    }
+};
+
+#endif // _DRCCTLIB_BRANCH_PREDICTOR_H_
@@ -0,0 +1,154 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_cache_sim.h
+ *
+ * Set-associative cache hierarchy for the proj0 clients, for machines where hardware
+ * miss counters are not available. Each level is configured by its size, associativity
+ * and the shared line size, and replaces the least recently used way of a set. A level
+ * is only looked up when every level above it missed, so the hierarchy is
+ * non-inclusive and write-allocate, stores are treated like loads.
+ *
+ * The simulator is not thread safe, the clients keep one hierarchy per thread.
+ */
+
+#ifndef _DRCCTLIB_CACHE_SIM_H_
+#define _DRCCTLIB_CACHE_SIM_H_
+
+#include <string.h>
+
+#include "dr_api.h"
+
+#define CACHE_SIM_MAX_LEVEL 2
+
+struct cache_config_t {
+    int32_t size;
+    int32_t assoc;
+};
+
+struct cache_level_t {
+    int32_t set_num;
+    int32_t assoc;
+    // set_num * assoc ways, line address + 1 so that 0 marks an empty way
+    uint64_t *tags;
+    // time of the last access of each way
+    uint64_t *stamps;
+    uint64_t clock;
+
+    void
+    init(int32_t set_count, int32_t way_count)
+    {
+        set_num = set_count;
+        assoc = way_count;
+        tags = (uint64_t *)dr_global_alloc(set_num * assoc * sizeof(uint64_t));
+        stamps = (uint64_t *)dr_global_alloc(set_num * assoc * sizeof(uint64_t));
+        memset(tags, 0, set_num * assoc * sizeof(uint64_t));
+        memset(stamps, 0, set_num * assoc * sizeof(uint64_t));
+        clock = 0;
+    }
+
+    void
+    free()
+    {
+        dr_global_free(tags, set_num * assoc * sizeof(uint64_t));
+        dr_global_free(stamps, set_num * assoc * sizeof(uint64_t));
+    }
+
+    // true on a hit, a miss fills the LRU way of the set
+    inline bool
+    access(uint64_t line)
+    {
+        int32_t base = (int32_t)(line & (set_num - 1)) * assoc;
+        uint64_t tag = line + 1;
+        int32_t victim = base;
+        clock++;
+        for (int32_t w = base; w < base + assoc; w++) {
+            if (tags[w] == tag) {
+                stamps[w] = clock;
+                return true;
+            }
+            if (stamps[w] < stamps[victim]) {
+                victim = w;
+            }
+        }
+        tags[victim] = tag;
+        stamps[victim] = clock;
+        return false;
+    }
+};
+
+struct cache_sim_t {
+    int32_t level_num;
+    int32_t line_shift;
+    cache_level_t levels[CACHE_SIM_MAX_LEVEL];
+
+    // the line size and the set count of every level must be powers of two
+    static bool
+    valid_config(const cache_config_t *configs, int32_t config_num, int32_t line_size)
+    {
+        if (line_size <= 0 || (line_size & (line_size - 1)) != 0) {
+            return false;
+        }
+        for (int32_t l = 0; l < config_num; l++) {
+            if (configs[l].assoc <= 0 ||
+                configs[l].size % (line_size * configs[l].assoc) != 0) {
+                return false;
+            }
+            int32_t set_num = configs[l].size / (line_size * configs[l].assoc);
+            if (set_num <= 0 || (set_num & (set_num - 1)) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void
+    init(const cache_config_t *configs, int32_t config_num, int32_t line_size)
+    {
+        level_num = config_num;
+        line_shift = __builtin_ctz(line_size);
+        for (int32_t l = 0; l < level_num; l++) {
+            levels[l].init(configs[l].size / (line_size * configs[l].assoc),
+                           configs[l].assoc);
+        }
+    }
+
+    void
+    free()
+    {
+        for (int32_t l = 0; l < level_num; l++) {
+            levels[l].free();
+        }
+    }
+
+    // Number of levels that missed on the line, level_num if it came from memory.
+    inline int32_t
+    access_line(uint64_t line)
+    {
+        int32_t l = 0;
+        while (l < level_num && !levels[l].access(line)) {
+            l++;
+        }
+        return l;
+    }
+
+    // An access that straddles a line boundary touches both lines, misses[l] counts
+    // the lines missed in level l.
+    inline void
+    access(uint64_t addr, uint32_t size, uint64_t *misses)
+    {
+        uint64_t first = addr >> line_shift;
+        uint64_t last = (addr + (size == 0 ? 0 : size - 1)) >> line_shift;
+        for (uint64_t line = first; line <= last; line++) {
+            int32_t missed = access_line(line);
+            for (int32_t l = 0; l < missed; l++) {
+                misses[l]++;
+            }
+        }
+    }
+};
+
+#endif // _DRCCTLIB_CACHE_SIM_H_
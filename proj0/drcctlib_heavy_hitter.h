@@ -0,0 +1,249 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_heavy_hitter.h
+ *
+ * Space-saving sketch (Metwally et al.) over context handles. It monitors at most K
+ * handles in bounded memory, so the hottest contexts can be read at any time without a
+ * scan over the counter tables.
+ *
+ * Error bounds, with N the total weight passed to update():
+ * - every monitored handle satisfies count - error <= exact count <= count
+ * - error <= N / K for every monitored handle
+ * - every handle whose exact count is larger than N / K is monitored
+ *
+ * The counters form a min-heap on count and a linear probing hash maps a handle to its
+ * heap slot, so update() is O(log K) and copy() is O(K).
+ *
+ * Sketches of disjoint streams, e.g. one per thread, merge with heavy_hitter_merge():
+ * a handle a sketch does not monitor occurred at most min_count() times in its stream,
+ * so that much is added to the merged count and error. The merged entries keep the
+ * bounds above with N the sum over the streams. Every handle above N / K is above
+ * N_i / K in some stream i and so in the union, which is why the merge keeps all
+ * candidates instead of only K.
+ */
+
+#ifndef _DRCCTLIB_HEAVY_HITTER_H_
+#define _DRCCTLIB_HEAVY_HITTER_H_
+
+#include <string.h>
+#include <algorithm>
+
+#include "dr_api.h"
+#include "drcctlib.h"
+
+typedef struct _heavy_hitter_entry_t {
+    context_handle_t handle;
+    uint64_t count;
+    // upper bound of how much of count was inherited from an evicted handle
+    uint64_t error;
+} heavy_hitter_entry_t;
+
+struct heavy_hitter_t {
+    heavy_hitter_entry_t *entries;
+    int32_t capacity;
+    int32_t size;
+    // handle -> index in entries, -1 for an empty slot
+    int32_t *hash;
+    int32_t hash_mask;
+    uint64_t total;
+
+    void
+    init(int32_t k)
+    {
+        capacity = k;
+        size = 0;
+        total = 0;
+        entries = (heavy_hitter_entry_t *)dr_global_alloc(k * sizeof(heavy_hitter_entry_t));
+        int32_t hash_size = 1;
+        while (hash_size < 2 * k) {
+            hash_size <<= 1;
+        }
+        hash_mask = hash_size - 1;
+        hash = (int32_t *)dr_global_alloc(hash_size * sizeof(int32_t));
+        memset(hash, 0xff, hash_size * sizeof(int32_t));
+    }
+
+    void
+    free()
+    {
+        dr_global_free(entries, capacity * sizeof(heavy_hitter_entry_t));
+        dr_global_free(hash, (hash_mask + 1) * sizeof(int32_t));
+    }
+
+    void
+    update(context_handle_t handle, uint64_t weight)
+    {
+        total += weight;
+        int32_t slot = find_slot(handle);
+        int32_t idx = hash[slot];
+        if (idx >= 0) {
+            entries[idx].count += weight;
+            sift_down(idx);
+            return;
+        }
+        if (size < capacity) {
+            idx = size++;
+            entries[idx].handle = handle;
+            entries[idx].count = weight;
+            entries[idx].error = 0;
+            hash[slot] = idx;
+            sift_up(idx);
+            return;
+        }
+        // evict the smallest counter, the new handle inherits its count as error
+        hash_remove(entries[0].handle);
+        entries[0].handle = handle;
+        entries[0].error = entries[0].count;
+        entries[0].count += weight;
+        hash[find_slot(handle)] = 0;
+        sift_down(0);
+    }
+
+    // copies the monitored entries, unsorted, and returns their number
+    int32_t
+    copy(heavy_hitter_entry_t *out) const
+    {
+        memcpy(out, entries, size * sizeof(heavy_hitter_entry_t));
+        return size;
+    }
+
+    // largest error a monitored count can have, N / K
+    uint64_t
+    error_bound() const
+    {
+        return total / capacity;
+    }
+
+    // upper bound of the count of every handle that is not monitored
+    uint64_t
+    min_count() const
+    {
+        return size < capacity ? 0 : entries[0].count;
+    }
+
+private:
+    static inline uint32_t
+    hash_handle(context_handle_t handle)
+    {
+        return (uint32_t)handle * 2654435761u;
+    }
+
+    // slot holding handle, or the empty slot where it would go
+    inline int32_t
+    find_slot(context_handle_t handle) const
+    {
+        int32_t slot = hash_handle(handle) & hash_mask;
+        while (hash[slot] >= 0 && entries[hash[slot]].handle != handle) {
+            slot = (slot + 1) & hash_mask;
+        }
+        return slot;
+    }
+
+    // backward shift deletion, keeps probe chains intact without tombstones
+    void
+    hash_remove(context_handle_t handle)
+    {
+        int32_t hole = find_slot(handle);
+        int32_t slot = hole;
+        hash[hole] = -1;
+        for (;;) {
+            slot = (slot + 1) & hash_mask;
+            if (hash[slot] < 0) {
+                return;
+            }
+            int32_t home = hash_handle(entries[hash[slot]].handle) & hash_mask;
+            // move the entry into the hole unless its home lies cyclically in (hole, slot]
+            if (((slot - home) & hash_mask) >= ((slot - hole) & hash_mask)) {
+                hash[hole] = hash[slot];
+                hash[slot] = -1;
+                hole = slot;
+            }
+        }
+    }
+
+    inline void
+    swap_entries(int32_t a, int32_t b)
+    {
+        int32_t slot_a = find_slot(entries[a].handle);
+        int32_t slot_b = find_slot(entries[b].handle);
+        std::swap(entries[a], entries[b]);
+        hash[slot_a] = b;
+        hash[slot_b] = a;
+    }
+
+    inline void
+    sift_up(int32_t i)
+    {
+        while (i > 0) {
+            int32_t parent = (i - 1) / 2;
+            if (entries[parent].count <= entries[i].count) {
+                break;
+            }
+            swap_entries(parent, i);
+            i = parent;
+        }
+    }
+
+    inline void
+    sift_down(int32_t i)
+    {
+        for (;;) {
+            int32_t smallest = i;
+            int32_t left = 2 * i + 1;
+            int32_t right = left + 1;
+            if (left < size && entries[left].count < entries[smallest].count) {
+                smallest = left;
+            }
+            if (right < size && entries[right].count < entries[smallest].count) {
+                smallest = right;
+            }
+            if (smallest == i) {
+                break;
+            }
+            swap_entries(smallest, i);
+            i = smallest;
+        }
+    }
+};
+
+// Merges the copies of sketch_num sketches, stored back to back in entries with sketch
+// s contributing sizes[s] entries and min_count() mins[s]. The merged entries, one per
+// handle and unsorted, replace the input, their number is returned.
+static inline int32_t
+heavy_hitter_merge(heavy_hitter_entry_t *entries, const int32_t *sizes,
+                   const uint64_t *mins, int32_t sketch_num)
+{
+    // every handle starts at the sum of the minima, a sketch that monitors it replaces
+    // its minimum by its count. Counts and errors are taken relative to the minimum of
+    // their sketch up front; the unsigned sums wrap back to the right values.
+    uint64_t min_sum = 0;
+    int32_t entry_num = 0;
+    for (int32_t s = 0; s < sketch_num; s++) {
+        min_sum += mins[s];
+        for (int32_t i = entry_num; i < entry_num + sizes[s]; i++) {
+            entries[i].count -= mins[s];
+            entries[i].error -= mins[s];
+        }
+        entry_num += sizes[s];
+    }
+    std::sort(entries, entries + entry_num,
+              [](const heavy_hitter_entry_t &a, const heavy_hitter_entry_t &b) {
+                  return a.handle < b.handle;
+              });
+    int32_t merged_num = 0;
+    for (int32_t i = 0; i < entry_num;) {
+        heavy_hitter_entry_t merged = { entries[i].handle, min_sum, min_sum };
+        for (; i < entry_num && entries[i].handle == merged.handle; i++) {
+            merged.count += entries[i].count;
+            merged.error += entries[i].error;
+        }
+        entries[merged_num++] = merged;
+    }
+    return merged_num;
+}
+
+#endif // _DRCCTLIB_HEAVY_HITTER_H_
@@ -1,9 +1,24 @@
 #include <iterator>
 #include <vector>
 #include <map>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include "dr_api.h"
+#include "drmgr.h"
+#include "drutil.h"
+#include "drx.h"
 #include "drcctlib.h"
+#include "drcctlib_paged_table.h"
+#include "drcctlib_top_n.h"
+#include "drcctlib_sampling.h"
+#include "drcctlib_binary_profile.h"
+#include "drcctlib_cache_sim.h"
+#include "drcctlib_reuse_distance.h"
+#include "drcctlib_branch_predictor.h"
+#include "drcctlib_roi.h"
+#include "drcctlib_vscodeex_format.h"
 
 #define DRCCTLIB_PRINTF(_FORMAT, _ARGS...) \
     DRCCTLIB_PRINTF_TEMPLATE("instr_analysis", _FORMAT, ##_ARGS)
@@ -22,59 +37,200 @@
 #define MEM_STORE_PROJ0 1
 #define COND_BRANCH_PROJ0 2
 #define UNCOND_BRANCH_PROJ0 3
+#define INSTR_TYPE_NUM_PROJ0 4
 
-static uint64_t mem_load = 0;
-static uint64_t mem_store = 0;
-static uint64_t cond_branch = 0;
-static uint64_t uncond_branch = 0;
+// instr_bits has one bit per instruction type, the load bit is the most significant
+#define INSTR_TYPE_BIT(instr_type) (8 >> (instr_type))
 
-uint64_t *gloabl_hndl_call_num_load;
-uint64_t *gloabl_hndl_call_num_store;
-uint64_t *gloabl_hndl_call_num_cond;
-uint64_t *gloabl_hndl_call_num_uncond;
+static const char *instr_type_name[INSTR_TYPE_NUM_PROJ0] = {
+    "MEMORY LOAD", "MEMORY STORE", "CONDITIONAL BRANCHES", "UNCONDITIONAL BRANCHES"
+};
+
+// All counters of one context share a record, so an instruction that both loads and
+// stores touches a single cache line. Records are aligned to their size and never
+// straddle a line.
+typedef struct _instr_count_t {
+    uint64_t count[INSTR_TYPE_NUM_PROJ0];
+} __attribute__((aligned(32))) instr_count_t;
+
+static uint64_t instr_total[INSTR_TYPE_NUM_PROJ0];
+paged_table_t<instr_count_t> gloabl_hndl_instr_count;
+
+// -cache mode: misses per level of the simulated hierarchy, charged to the context of
+// the instruction that missed
+typedef struct _cache_miss_t {
+    uint64_t count[CACHE_SIM_MAX_LEVEL];
+} cache_miss_t;
+
+static const char *cache_level_name[CACHE_SIM_MAX_LEVEL] = { "L1 MISSES", "LLC MISSES" };
+static uint64_t cache_access_total;
+static uint64_t cache_miss_total[CACHE_SIM_MAX_LEVEL];
+paged_table_t<cache_miss_t> gloabl_hndl_cache_miss;
+
+// -reuse mode: log2 histogram of the reuse distances of a context's accesses
+typedef struct _reuse_hist_t {
+    uint64_t count[REUSE_BIN_NUM];
+} reuse_hist_t;
+
+paged_table_t<reuse_hist_t> gloabl_hndl_reuse_hist;
+
+// -branch mode: directions of a context's conditional branch and the mispredictions
+// of the simulated predictors, indexed by BRANCH_MISS_*
+#define BRANCH_MISS_BIMODAL 0
+#define BRANCH_MISS_GSHARE 1
+#define BRANCH_PREDICTOR_NUM 2
+
+typedef struct _branch_stat_t {
+    uint64_t taken;
+    uint64_t not_taken;
+    uint64_t miss[BRANCH_PREDICTOR_NUM];
+} branch_stat_t;
+
+static uint64_t branch_total;
+static uint64_t branch_miss_total[BRANCH_PREDICTOR_NUM];
+paged_table_t<branch_stat_t> gloabl_hndl_branch_stat;
+
+// Application threads only count into their own per_thread_t. The totals and tables are
+// added into the globals above when the thread exits.
+typedef struct _per_thread_t {
+    uint64_t instr_total[INSTR_TYPE_NUM_PROJ0];
+    paged_table_t<instr_count_t> hndl_instr_count;
+    paged_table_t<uint64_t> bb_entry_num;
+    // -cache mode, every thread simulates a private hierarchy
+    cache_sim_t cache;
+    uint64_t cache_access_total;
+    uint64_t cache_miss_total[CACHE_SIM_MAX_LEVEL];
+    paged_table_t<cache_miss_t> hndl_cache_miss;
+    // -reuse mode
+    reuse_distance_t reuse;
+    paged_table_t<reuse_hist_t> hndl_reuse_hist;
+    // -branch mode
+    branch_predictor_t predictor;
+    uint64_t branch_total;
+    uint64_t branch_miss_total[BRANCH_PREDICTOR_NUM];
+    paged_table_t<branch_stat_t> hndl_branch_stat;
+    // live threads, for snapshots
+    struct _per_thread_t *prev;
+    struct _per_thread_t *next;
+} per_thread_t;
+
+static int tls_idx;
+// protects the global tables and live_threads
+static void *merge_lock;
+static per_thread_t *live_threads = NULL;
+
+// -bb mode: one entry counter per block and calling context, indexed by the context
+// handle of the first instruction of the block. The block's instruction categories
+// live in a bb_desc_t built at translation time.
+typedef struct _bb_desc_t {
+    int32_t instr_num;
+    int32_t *instr_bits;
+    struct _bb_desc_t *next;
+} bb_desc_t;
+
+paged_table_t<uint64_t> gloabl_bb_entry_num;
+paged_table_t<bb_desc_t *> gloabl_bb_desc;
+static bb_desc_t *bb_desc_list = NULL;
+static void *bb_desc_lock;
+
+// -snapshot mode, the tables are private to the snapshot thread
+static file_t gSnapshotFile;
+static uint64_t snapshot_total[INSTR_TYPE_NUM_PROJ0];
+static paged_table_t<instr_count_t> snapshot_instr_count;
+static paged_table_t<instr_count_t> snapshot_last_instr_count;
+
+// -sample and -sample_burst mode
+static sampler_t gSampler;
+
+// -roi mode
+static roi_t gRoi;
+
+static bool op_bb = false;
+static int32_t op_snapshot = 0;
+static bool op_snapshot_delta = false;
+static int32_t op_sample_period = 1;
+static int32_t op_sample_burst = 1;
+static bool op_binary = false;
+static bool op_drcctprof = false;
+static bool op_memtrace = false;
+static bool op_cache = false;
+static cache_config_t op_cache_config[CACHE_SIM_MAX_LEVEL] = { { 32 * 1024, 8 },
+                                                               { 2 * 1024 * 1024, 16 } };
+static int32_t op_cache_line = 64;
+static bool op_reuse = false;
+static bool op_branch = false;
+static bool op_roi = false;
 
 static file_t gTraceFile;
 
 using namespace std;
 
 // Execution
+// One instantiation per load/store/cond/uncond combination, so the category tests are
+// resolved at compile time instead of on every execution.
+template <int32_t instr_bits>
 void
-InsCount(int32_t instr_bits, int32_t slot)
+InsCount(int32_t slot)
 {
+    if (op_sample_period > 1 && !gSampler.sampled()) {
+        return;
+    }
     void *drcontext = dr_get_current_drcontext();
+    per_thread_t *pt = (per_thread_t *)drmgr_get_tls_field(drcontext, tls_idx);
     context_handle_t cur_ctxt_hndl = drcctlib_get_context_handle(drcontext, slot);
+    instr_count_t *instr_count = &pt->hndl_instr_count.get(cur_ctxt_hndl);
 
-    int32_t mem_load_val = (instr_bits & 8) >> 3;
-    int32_t mem_store_val = (instr_bits & 4) >> 2;
-    int32_t cond_branch_val = (instr_bits & 2) >> 1;
-    int32_t uncond_branch_val = instr_bits & 1;
-    if(mem_load_val == 1) {
-        mem_load++;
-        gloabl_hndl_call_num_load[cur_ctxt_hndl]++;
+    if ((instr_bits & INSTR_TYPE_BIT(MEM_LOAD_PROJ0)) != 0) {
+        pt->instr_total[MEM_LOAD_PROJ0]++;
+        instr_count->count[MEM_LOAD_PROJ0]++;
     }
-    if(mem_store_val == 1) {
-        mem_store++;
-        gloabl_hndl_call_num_store[cur_ctxt_hndl]++;
+    if ((instr_bits & INSTR_TYPE_BIT(MEM_STORE_PROJ0)) != 0) {
+        pt->instr_total[MEM_STORE_PROJ0]++;
+        instr_count->count[MEM_STORE_PROJ0]++;
     }
-    if(cond_branch_val == 1) {
-        cond_branch++;
-        gloabl_hndl_call_num_cond[cur_ctxt_hndl]++;
+    if ((instr_bits & INSTR_TYPE_BIT(COND_BRANCH_PROJ0)) != 0) {
+        pt->instr_total[COND_BRANCH_PROJ0]++;
+        instr_count->count[COND_BRANCH_PROJ0]++;
+    }
+    if ((instr_bits & INSTR_TYPE_BIT(UNCOND_BRANCH_PROJ0)) != 0) {
+        pt->instr_total[UNCOND_BRANCH_PROJ0]++;
+        instr_count->count[UNCOND_BRANCH_PROJ0]++;
     }
-    if(uncond_branch_val == 1) {
-        uncond_branch++;
-        gloabl_hndl_call_num_uncond[cur_ctxt_hndl]++;
-    }    
 }
 
-// Transformation
+// indexed by instr_bits, instructions without a category are not instrumented
+static void (*const ins_count_callbacks[16])(int32_t) = {
+    NULL,          InsCount<1>,  InsCount<2>,  InsCount<3>,
+    InsCount<4>,   InsCount<5>,  InsCount<6>,  InsCount<7>,
+    InsCount<8>,   InsCount<9>,  InsCount<10>, InsCount<11>,
+    InsCount<12>,  InsCount<13>, InsCount<14>, InsCount<15>
+};
+
+// The instructions of one block in one calling context get consecutive handles, so the
+// handle of slot 0 identifies the block.
 void
-InsTransEventCallback(void *drcontext, instr_instrument_msg_t *instrument_msg)
+BBCount(bb_desc_t *desc)
 {
+    if (op_sample_period > 1 && !gSampler.sampled()) {
+        return;
+    }
+    void *drcontext = dr_get_current_drcontext();
+    per_thread_t *pt = (per_thread_t *)drmgr_get_tls_field(drcontext, tls_idx);
+    context_handle_t bb_start_hndl = drcctlib_get_context_handle(drcontext, 0);
+    pt->bb_entry_num.get(bb_start_hndl)++;
+    // The descriptor of a handle never changes, only the first entry stores it, so
+    // the shared table is read, not written, on the hot path.
+    bb_desc_t **desc_slot = &gloabl_bb_desc.get(bb_start_hndl);
+    if (__atomic_load_n(desc_slot, __ATOMIC_ACQUIRE) == NULL) {
+        bb_desc_t *expected = NULL;
+        __atomic_compare_exchange_n(desc_slot, &expected, desc, false, __ATOMIC_RELEASE,
+                                    __ATOMIC_RELAXED);
+    }
+}
 
-    instrlist_t *bb = instrument_msg->bb;
-    instr_t *instr = instrument_msg->instr;
-    int32_t slot = instrument_msg->slot;
-
+static int32_t
+GetInstrBits(instr_t *instr)
+{
     int32_t instr_bits = 0;
     int32_t mask = 0;
     if(instr_reads_memory(instr)) {
@@ -93,164 +249,1094 @@ InsTransEventCallback(void *drcontext, instr_instrument_msg_t *instrument_msg)
         mask = 1 << 0;
         instr_bits = instr_bits | mask;
     }
+    return instr_bits;
+}
+
+// returns NULL when no instruction of the block has a category
+static bb_desc_t *
+CreateBBDesc(instr_t *first_instr)
+{
+    int32_t instr_num = 0;
+    for (instr_t *i = first_instr; i != NULL; i = instr_get_next_app(i)) {
+        instr_num++;
+    }
+    bb_desc_t *desc = (bb_desc_t *)dr_global_alloc(sizeof(bb_desc_t));
+    desc->instr_num = instr_num;
+    desc->instr_bits = (int32_t *)dr_global_alloc(instr_num * sizeof(int32_t));
+    int32_t j = 0;
+    int32_t bb_bits = 0;
+    for (instr_t *i = first_instr; i != NULL; i = instr_get_next_app(i)) {
+        desc->instr_bits[j] = GetInstrBits(i);
+        bb_bits |= desc->instr_bits[j];
+        j++;
+    }
+    if (bb_bits == 0) {
+        dr_global_free(desc->instr_bits, instr_num * sizeof(int32_t));
+        dr_global_free(desc, sizeof(bb_desc_t));
+        return NULL;
+    }
+    // a block can be retranslated, so descriptors are only released at exit
+    dr_mutex_lock(bb_desc_lock);
+    desc->next = bb_desc_list;
+    bb_desc_list = desc;
+    dr_mutex_unlock(bb_desc_lock);
+    return desc;
+}
+
+static void
+InsertCleanCall(void *drcontext, instrlist_t *bb, instr_t *instr, void *callee, opnd_t arg)
+{
+    if (op_sample_period > 1) {
+        gSampler.insert_clean_call(drcontext, bb, instr, callee, arg);
+    } else {
+        dr_insert_clean_call(drcontext, bb, instr, callee, false, 1, arg);
+    }
+}
+
+// -memtrace, -cache and -reuse mode: per memory operand of every executed instruction,
+// one record is stored inline into a per-thread drx_buf trace buffer. Each full buffer
+// is a batch, it is appended to the trace file as one chunk, see memtrace_view.py, run
+// through the thread's cache hierarchy and/or its reuse distance tree.
+typedef struct _mem_ref_t {
+    context_handle_t ctxt_hndl;
+    uint16_t size;
+    // 1 for a store
+    uint16_t is_write;
+    app_pc addr;
+} mem_ref_t;
+
+// precedes the records of one buffer in the trace file
+typedef struct _mem_trace_chunk_t {
+    int32_t tid;
+    uint32_t ref_num;
+} mem_trace_chunk_t;
+
+#define MEM_TRACE_BUF_SIZE (sizeof(mem_ref_t) * 65536)
+
+static drx_buf_t *gMemTraceBuf;
+static file_t gMemTraceFile;
+static void *mem_trace_lock;
+
+static void
+SimulateMemRefs(per_thread_t *pt, mem_ref_t *refs, uint32_t ref_num)
+{
+    context_handle_t last_hndl = 0;
+    cache_miss_t *cache_miss = NULL;
+    for (uint32_t i = 0; i < ref_num; i++) {
+        // consecutive records mostly come from the same context
+        if (cache_miss == NULL || refs[i].ctxt_hndl != last_hndl) {
+            last_hndl = refs[i].ctxt_hndl;
+            cache_miss = &pt->hndl_cache_miss.get(last_hndl);
+        }
+        uint64_t misses[CACHE_SIM_MAX_LEVEL] = { 0 };
+        pt->cache.access((uint64_t)refs[i].addr, refs[i].size, misses);
+        for (int32_t l = 0; l < CACHE_SIM_MAX_LEVEL; l++) {
+            cache_miss->count[l] += misses[l];
+            pt->cache_miss_total[l] += misses[l];
+        }
+    }
+    pt->cache_access_total += ref_num;
+}
+
+// Every line an access touches is one reuse.
+static void
+MeasureReuse(per_thread_t *pt, mem_ref_t *refs, uint32_t ref_num)
+{
+    context_handle_t last_hndl = 0;
+    reuse_hist_t *reuse_hist = NULL;
+    int32_t line_shift = __builtin_ctz(op_cache_line);
+    for (uint32_t i = 0; i < ref_num; i++) {
+        if (reuse_hist == NULL || refs[i].ctxt_hndl != last_hndl) {
+            last_hndl = refs[i].ctxt_hndl;
+            reuse_hist = &pt->hndl_reuse_hist.get(last_hndl);
+        }
+        uint64_t addr = (uint64_t)refs[i].addr;
+        uint64_t first = addr >> line_shift;
+        uint64_t last = (addr + (refs[i].size == 0 ? 0 : refs[i].size - 1)) >> line_shift;
+        for (uint64_t line = first; line <= last; line++) {
+            reuse_hist->count[reuse_bin(pt->reuse.access(line))]++;
+        }
+    }
+}
+
+// drx_buf calls this when a thread's buffer is full, the buffer is reset afterwards.
+// ClientThreadEnd hands over the rest of the buffer itself.
+static void
+MemTraceBufFull(void *drcontext, void *buf_base, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+    uint32_t ref_num = (uint32_t)(size / sizeof(mem_ref_t));
+    per_thread_t *pt = (per_thread_t *)drmgr_get_tls_field(drcontext, tls_idx);
+    if (op_cache) {
+        SimulateMemRefs(pt, (mem_ref_t *)buf_base, ref_num);
+    }
+    if (op_reuse) {
+        MeasureReuse(pt, (mem_ref_t *)buf_base, ref_num);
+    }
+    if (op_memtrace) {
+        mem_trace_chunk_t chunk = { (int32_t)dr_get_thread_id(drcontext), ref_num };
+        dr_mutex_lock(mem_trace_lock);
+        dr_write_file(gMemTraceFile, &chunk, sizeof(chunk));
+        dr_write_file(gMemTraceFile, buf_base, size);
+        dr_mutex_unlock(mem_trace_lock);
+    }
+}
+
+// reg_hndl already holds the context handle, reg_addr is clobbered
+static void
+InsertMemRef(void *drcontext, instrlist_t *bb, instr_t *instr, opnd_t ref, bool is_write,
+             reg_id_t reg_ptr, reg_id_t reg_addr, reg_id_t reg_hndl)
+{
+    if (!drutil_insert_get_mem_addr(drcontext, bb, instr, ref, reg_addr, reg_ptr)) {
+        DRCCTLIB_EXIT_PROCESS("InsertMemRef drutil_insert_get_mem_addr fail");
+    }
+    drx_buf_insert_load_buf_ptr(drcontext, gMemTraceBuf, bb, instr, reg_ptr);
+    drx_buf_insert_buf_store(drcontext, gMemTraceBuf, bb, instr, reg_ptr, DR_REG_NULL,
+                             opnd_create_reg(reg_addr), OPSZ_PTR,
+                             offsetof(mem_ref_t, addr));
+    drx_buf_insert_buf_store(drcontext, gMemTraceBuf, bb, instr, reg_ptr, DR_REG_NULL,
+                             opnd_create_reg(reg_resize_to_opsz(reg_hndl, OPSZ_4)),
+                             OPSZ_4, offsetof(mem_ref_t, ctxt_hndl));
+    uint16_t size = (uint16_t)drutil_opnd_mem_size_in_bytes(ref, instr);
+    drx_buf_insert_buf_store(drcontext, gMemTraceBuf, bb, instr, reg_ptr, reg_addr,
+                             OPND_CREATE_INT16(size), OPSZ_2, offsetof(mem_ref_t, size));
+    drx_buf_insert_buf_store(drcontext, gMemTraceBuf, bb, instr, reg_ptr, reg_addr,
+                             OPND_CREATE_INT16(is_write ? 1 : 0), OPSZ_2,
+                             offsetof(mem_ref_t, is_write));
+    drx_buf_insert_update_buf_ptr(drcontext, gMemTraceBuf, bb, instr, reg_ptr, reg_addr,
+                                  sizeof(mem_ref_t));
+}
+
+// no clean call: the context handle, the addresses and the records are all inlined
+static void
+InstrumentMemRefs(void *drcontext, instrlist_t *bb, instr_t *instr, int32_t slot)
+{
+    if (!instr_reads_memory(instr) && !instr_writes_memory(instr)) {
+        return;
+    }
+    reg_id_t reg_ptr, reg_addr, reg_hndl;
+    // the handle lookup of a slot != 0 and the buffer pointer update both add
+    if (drreg_reserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, NULL, &reg_ptr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, NULL, &reg_addr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, NULL, &reg_hndl) != DRREG_SUCCESS) {
+        DRCCTLIB_EXIT_PROCESS("InstrumentMemRefs drreg_reserve_register != DRREG_SUCCESS");
+    }
+    drcctlib_get_context_handle_in_reg(drcontext, bb, instr, slot, reg_hndl, reg_ptr);
+    for (int i = 0; i < instr_num_srcs(instr); i++) {
+        if (opnd_is_memory_reference(instr_get_src(instr, i))) {
+            InsertMemRef(drcontext, bb, instr, instr_get_src(instr, i), false, reg_ptr,
+                         reg_addr, reg_hndl);
+        }
+    }
+    for (int i = 0; i < instr_num_dsts(instr); i++) {
+        if (opnd_is_memory_reference(instr_get_dst(instr, i))) {
+            InsertMemRef(drcontext, bb, instr, instr_get_dst(instr, i), true, reg_ptr,
+                         reg_addr, reg_hndl);
+        }
+    }
+    if (drreg_unreserve_register(drcontext, bb, instr, reg_ptr) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, instr, reg_addr) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, instr, reg_hndl) != DRREG_SUCCESS ||
+        drreg_unreserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        DRCCTLIB_EXIT_PROCESS("InstrumentMemRefs drreg_unreserve_register != DRREG_SUCCESS");
+    }
+}
+
+// -branch mode, called by dr_insert_cbr_instrumentation_ex before every conditional
+// branch with its direction
+static void
+BranchCallback(app_pc src, app_pc targ, app_pc fall, int taken, void *user_data)
+{
+    void *drcontext = dr_get_current_drcontext();
+    per_thread_t *pt = (per_thread_t *)drmgr_get_tls_field(drcontext, tls_idx);
+    int32_t slot = (int32_t)(ptr_int_t)user_data;
+    context_handle_t cur_ctxt_hndl = drcctlib_get_context_handle(drcontext, slot);
+    branch_stat_t *branch_stat = &pt->hndl_branch_stat.get(cur_ctxt_hndl);
+
+    if (taken != 0) {
+        branch_stat->taken++;
+    } else {
+        branch_stat->not_taken++;
+    }
+    int32_t missed = pt->predictor.update(src, taken != 0);
+    if ((missed & 1) != 0) {
+        branch_stat->miss[BRANCH_MISS_BIMODAL]++;
+        pt->branch_miss_total[BRANCH_MISS_BIMODAL]++;
+    }
+    if ((missed & 2) != 0) {
+        branch_stat->miss[BRANCH_MISS_GSHARE]++;
+        pt->branch_miss_total[BRANCH_MISS_GSHARE]++;
+    }
+    pt->branch_total++;
+}
+
+// -roi mode
+static bool
+RoiFilter(instr_t *instr)
+{
+    return gRoi.filter(instr);
+}
+
+static void
+RoiMarker(int32_t type, app_pc next_pc)
+{
+    gRoi.update(type, next_pc);
+}
+
+// Transformation
+void
+InsTransEventCallback(void *drcontext, instr_instrument_msg_t *instrument_msg)
+{
+
+    instrlist_t *bb = instrument_msg->bb;
+    instr_t *instr = instrument_msg->instr;
+    int32_t slot = instrument_msg->slot;
+
+    int32_t roi_marker = gRoi.marker(instr);
+    if (roi_marker != ROI_MARKER_NONE) {
+        gRoi.insert_marker_call(drcontext, bb, instr, roi_marker, (void *)RoiMarker);
+        return;
+    }
+    if (!gRoi.active()) {
+        return;
+    }
+
+    if (op_memtrace || op_cache || op_reuse) {
+        InstrumentMemRefs(drcontext, bb, instr, slot);
+    }
+    if (op_branch && instr_is_cbr(instr)) {
+        dr_insert_cbr_instrumentation_ex(drcontext, bb, instr, (void *)BranchCallback,
+                                         OPND_CREATE_CCT_INT(slot));
+    }
 
-    dr_insert_clean_call(drcontext, bb, instr, (void *)InsCount, false, 2, OPND_CREATE_INT32(instr_bits), OPND_CREATE_CCT_INT(slot));
+    if (op_bb) {
+        if (slot != 0) {
+            return;
+        }
+        bb_desc_t *desc = CreateBBDesc(instr);
+        if (desc != NULL) {
+            InsertCleanCall(drcontext, bb, instr, (void *)BBCount,
+                            OPND_CREATE_INTPTR((ptr_int_t)desc));
+        }
+        return;
+    }
+
+    int32_t instr_bits = GetInstrBits(instr);
+    if (instr_bits == 0) {
+        return;
+    }
+    InsertCleanCall(drcontext, bb, instr, (void *)ins_count_callbacks[instr_bits],
+                    OPND_CREATE_CCT_INT(slot));
 }
 
 static inline void
 InitGlobalBuff()
 {
-    gloabl_hndl_call_num_uncond = (uint64_t *)dr_raw_mem_alloc(
-        CONTEXT_HANDLE_MAX * sizeof(uint64_t), DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
-    if (gloabl_hndl_call_num_uncond == NULL) {
+    if (!gloabl_hndl_instr_count.init(false)) {
         DRCCTLIB_EXIT_PROCESS(
-            "init_global_buff error: dr_raw_mem_alloc fail gloabl_hndl_call_num_uncond");
+            "init_global_buff error: dr_raw_mem_alloc fail gloabl_hndl_instr_count");
     }
 
-    gloabl_hndl_call_num_cond = (uint64_t *)dr_raw_mem_alloc(
-        CONTEXT_HANDLE_MAX * sizeof(uint64_t), DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
-    if (gloabl_hndl_call_num_cond == NULL) {
-        DRCCTLIB_EXIT_PROCESS(
-            "init_global_buff error: dr_raw_mem_alloc fail gloabl_hndl_call_num_cond");
+    if (!op_bb) {
+        return;
     }
-
-    gloabl_hndl_call_num_load = (uint64_t *)dr_raw_mem_alloc(
-        CONTEXT_HANDLE_MAX * sizeof(uint64_t), DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
-    if (gloabl_hndl_call_num_load == NULL) {
+    if (!gloabl_bb_entry_num.init(false)) {
         DRCCTLIB_EXIT_PROCESS(
-            "init_global_buff error: dr_raw_mem_alloc fail gloabl_hndl_call_num_load");
+            "init_global_buff error: dr_raw_mem_alloc fail gloabl_bb_entry_num");
     }
-
-    gloabl_hndl_call_num_store = (uint64_t *)dr_raw_mem_alloc(
-        CONTEXT_HANDLE_MAX * sizeof(uint64_t), DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
-    if (gloabl_hndl_call_num_store == NULL) {
+    // written by all application threads
+    if (!gloabl_bb_desc.init(true)) {
         DRCCTLIB_EXIT_PROCESS(
-            "init_global_buff error: dr_raw_mem_alloc fail gloabl_hndl_call_num_store");
+            "init_global_buff error: dr_raw_mem_alloc fail gloabl_bb_desc");
     }
+    bb_desc_lock = dr_mutex_create();
 }
 
 static inline void
 FreeGlobalBuff()
 {
-    dr_raw_mem_free(gloabl_hndl_call_num_uncond, CONTEXT_HANDLE_MAX * sizeof(uint64_t));
-    dr_raw_mem_free(gloabl_hndl_call_num_cond, CONTEXT_HANDLE_MAX * sizeof(uint64_t));
-    dr_raw_mem_free(gloabl_hndl_call_num_load, CONTEXT_HANDLE_MAX * sizeof(uint64_t));
-    dr_raw_mem_free(gloabl_hndl_call_num_store, CONTEXT_HANDLE_MAX * sizeof(uint64_t));
+    gloabl_hndl_instr_count.free();
+
+    if (!op_bb) {
+        return;
+    }
+    gloabl_bb_entry_num.free();
+    gloabl_bb_desc.free();
+    while (bb_desc_list != NULL) {
+        bb_desc_t *next = bb_desc_list->next;
+        dr_global_free(bb_desc_list->instr_bits, bb_desc_list->instr_num * sizeof(int32_t));
+        dr_global_free(bb_desc_list, sizeof(bb_desc_t));
+        bb_desc_list = next;
+    }
+    dr_mutex_destroy(bb_desc_lock);
 }
 
+// -bb mode: add the entry count of a block to each of its instructions
 static void
-ClientInit(int argc, const char *argv[])
+ExpandBBEntry(paged_table_t<instr_count_t> &instr_count_table, uint64_t *totals,
+              context_handle_t bb_start_hndl, uint64_t entry_num)
 {
-    char name[MAXIMUM_FILEPATH] = "";
-    DRCCTLIB_INIT_LOG_FILE_NAME(
-        name, "instr_analysis", "out");
-    DRCCTLIB_PRINTF("Creating log file at:%s", name);
+    bb_desc_t **desc_ptr = gloabl_bb_desc.find(bb_start_hndl);
+    // a snapshot can see the entry count before BBCount stored the descriptor
+    bb_desc_t *desc =
+        desc_ptr == NULL ? NULL : __atomic_load_n(desc_ptr, __ATOMIC_ACQUIRE);
+    if (desc == NULL) {
+        return;
+    }
+    for (int32_t j = 0; j < desc->instr_num; j++) {
+        int32_t instr_bits = desc->instr_bits[j];
+        if (instr_bits == 0) {
+            continue;
+        }
+        instr_count_t &instr_count = instr_count_table.get(bb_start_hndl + j);
+        for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+            if ((instr_bits & INSTR_TYPE_BIT(t)) != 0) {
+                totals[t] += entry_num;
+                instr_count.count[t] += entry_num;
+            }
+        }
+    }
+}
 
-    gTraceFile = dr_open_file(name, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
-    DR_ASSERT(gTraceFile != INVALID_FILE);
+// -bb mode: turn block entry counts back into the per-instruction counts and totals
+// that InsCount would have produced
+static void
+ExpandBBCount()
+{
+    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+    paged_table_for_each(gloabl_bb_entry_num, max_ctxt_hndl,
+                         [](context_handle_t i, uint64_t &entry_num) {
+                             if (entry_num != 0) {
+                                 ExpandBBEntry(gloabl_hndl_instr_count, instr_total, i,
+                                               entry_num);
+                             }
+                         });
+}
 
-    InitGlobalBuff();
-    drcctlib_init(DRCCTLIB_FILTER_ALL_INSTR, INVALID_FILE, InsTransEventCallback, false);
+static void
+ClientThreadStart(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *)dr_thread_alloc(drcontext, sizeof(per_thread_t));
+    memset(pt, 0, sizeof(per_thread_t));
+    bool success = op_bb ? pt->bb_entry_num.init(false) : pt->hndl_instr_count.init(false);
+    if (op_cache) {
+        pt->cache.init(op_cache_config, CACHE_SIM_MAX_LEVEL, op_cache_line);
+        success = success && pt->hndl_cache_miss.init(false);
+    }
+    if (op_reuse) {
+        pt->reuse.init();
+        success = success && pt->hndl_reuse_hist.init(false);
+    }
+    if (op_branch) {
+        pt->predictor.init();
+        success = success && pt->hndl_branch_stat.init(false);
+    }
+    if (!success) {
+        DRCCTLIB_EXIT_PROCESS("ClientThreadStart error: dr_raw_mem_alloc fail");
+    }
+    drmgr_set_tls_field(drcontext, tls_idx, (void *)pt);
+
+    dr_mutex_lock(merge_lock);
+    pt->next = live_threads;
+    if (live_threads != NULL) {
+        live_threads->prev = pt;
+    }
+    live_threads = pt;
+    dr_mutex_unlock(merge_lock);
 }
 
-typedef struct _output_format_t {
-    context_handle_t handle;
-    uint64_t count;
-} output_format_t;
+// Only the pages the thread populated are walked.
+static void
+ClientThreadEnd(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *)drmgr_get_tls_field(drcontext, tls_idx);
+    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
 
+    if (op_memtrace || op_cache || op_reuse) {
+        // the last, partial batch while pt is still there. drx_buf's exit event runs
+        // after this one and finds the buffer empty.
+        byte *buf_base = (byte *)drx_buf_get_buffer_base(drcontext, gMemTraceBuf);
+        byte *buf_ptr = (byte *)drx_buf_get_buffer_ptr(drcontext, gMemTraceBuf);
+        MemTraceBufFull(drcontext, buf_base, buf_ptr - buf_base);
+        drx_buf_set_buffer_ptr(drcontext, gMemTraceBuf, buf_base);
+    }
+
+    dr_mutex_lock(merge_lock);
+    if (op_cache) {
+        cache_access_total += pt->cache_access_total;
+        for (int32_t l = 0; l < CACHE_SIM_MAX_LEVEL; l++) {
+            cache_miss_total[l] += pt->cache_miss_total[l];
+        }
+        paged_table_for_each(pt->hndl_cache_miss, max_ctxt_hndl,
+                             [](context_handle_t i, cache_miss_t &cache_miss) {
+            for (int32_t l = 0; l < CACHE_SIM_MAX_LEVEL; l++) {
+                if (cache_miss.count[l] != 0) {
+                    gloabl_hndl_cache_miss.get(i).count[l] += cache_miss.count[l];
+                }
+            }
+        });
+        pt->hndl_cache_miss.free();
+        pt->cache.free();
+    }
+    if (op_reuse) {
+        paged_table_for_each(pt->hndl_reuse_hist, max_ctxt_hndl,
+                             [](context_handle_t i, reuse_hist_t &reuse_hist) {
+            for (int32_t b = 0; b < REUSE_BIN_NUM; b++) {
+                if (reuse_hist.count[b] != 0) {
+                    gloabl_hndl_reuse_hist.get(i).count[b] += reuse_hist.count[b];
+                }
+            }
+        });
+        pt->hndl_reuse_hist.free();
+        pt->reuse.free();
+    }
+    if (op_branch) {
+        branch_total += pt->branch_total;
+        for (int32_t p = 0; p < BRANCH_PREDICTOR_NUM; p++) {
+            branch_miss_total[p] += pt->branch_miss_total[p];
+        }
+        paged_table_for_each(pt->hndl_branch_stat, max_ctxt_hndl,
+                             [](context_handle_t i, branch_stat_t &branch_stat) {
+            if (branch_stat.taken == 0 && branch_stat.not_taken == 0) {
+                return;
+            }
+            branch_stat_t &global_stat = gloabl_hndl_branch_stat.get(i);
+            global_stat.taken += branch_stat.taken;
+            global_stat.not_taken += branch_stat.not_taken;
+            for (int32_t p = 0; p < BRANCH_PREDICTOR_NUM; p++) {
+                global_stat.miss[p] += branch_stat.miss[p];
+            }
+        });
+        pt->hndl_branch_stat.free();
+    }
+    if (op_bb) {
+        paged_table_for_each(pt->bb_entry_num, max_ctxt_hndl,
+                             [](context_handle_t i, uint64_t &entry_num) {
+                                 if (entry_num != 0) {
+                                     gloabl_bb_entry_num.get(i) += entry_num;
+                                 }
+                             });
+        pt->bb_entry_num.free();
+    } else {
+        for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+            instr_total[t] += pt->instr_total[t];
+        }
+        paged_table_for_each(pt->hndl_instr_count, max_ctxt_hndl,
+                             [](context_handle_t i, instr_count_t &instr_count) {
+            for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+                if (instr_count.count[t] != 0) {
+                    gloabl_hndl_instr_count.get(i).count[t] += instr_count.count[t];
+                }
+            }
+        });
+        pt->hndl_instr_count.free();
+    }
+    if (pt->prev != NULL) {
+        pt->prev->next = pt->next;
+    } else {
+        live_threads = pt->next;
+    }
+    if (pt->next != NULL) {
+        pt->next->prev = pt->prev;
+    }
+    dr_mutex_unlock(merge_lock);
+
+    dr_thread_free(drcontext, pt, sizeof(per_thread_t));
+}
+
+static void
+print_calling_context(file_t file, int16_t instr_type, uint64_t total, top_n_t &top_list) {
+    dr_fprintf(file, "%s : %d\n", instr_type_name[instr_type], gSampler.estimate(total));
+
+    top_list.sort();
+
+    // print output
+    output_format_t *output_list = top_list.list;
+    for (int32_t i = 0; i < top_list.size; i++) {
+        dr_fprintf(file, "[NO. %d]", i + 1);
+        dr_fprintf(file, "Ins call times %lld\n",
+                   gSampler.estimate(output_list[i].count));
+        dr_fprintf(file, "================================================================================\n");
+        drcctlib_print_backtrace(file, output_list[i].handle, true, true, -1);
+        dr_fprintf(file, "================================================================================\n\n");
+    }
+}
+
+// One scan over the context records fills the top lists of all instruction types.
+static void
+print_all_calling_contexts(file_t file, paged_table_t<instr_count_t> &instr_count_table,
+                           uint64_t *totals)
+{
+    top_n_t top_lists[INSTR_TYPE_NUM_PROJ0];
+    for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+        top_lists[t].init(TOP_REACH_NUM_SHOW);
+    }
+
+    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+    paged_table_for_each(instr_count_table, max_ctxt_hndl,
+                         [&top_lists](context_handle_t i, instr_count_t &instr_count) {
+        for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+            if (instr_count.count[t] > top_lists[t].threshold()) {
+                top_lists[t].push(i, instr_count.count[t]);
+            }
+        }
+    });
+
+    if (op_sample_period > 1) {
+        dr_fprintf(file, "SAMPLING %d/%d, COUNTS ARE ESTIMATES\n\n", op_sample_burst,
+                   op_sample_period);
+    }
+    if (op_roi) {
+        dr_fprintf(file, "REGION OF INTEREST ONLY\n\n");
+    }
+    for (int16_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+        print_calling_context(file, t, totals[t], top_lists[t]);
+        top_lists[t].free();
+    }
+}
+
+// -cache mode, in the layout of print_calling_context. The memory references are not
+// sampled, so the counts are exact.
 static void
-print_calling_context(int16_t instr_type) {
-    uint64_t *gloabl_hndl_call_num;
-    
-    if(instr_type == MEM_LOAD_PROJ0) {
-        gloabl_hndl_call_num = gloabl_hndl_call_num_load;
-        dr_fprintf(gTraceFile, "MEMORY LOAD : %d\n", mem_load);
+print_cache_misses(file_t file)
+{
+    top_n_t top_lists[CACHE_SIM_MAX_LEVEL];
+    for (int32_t l = 0; l < CACHE_SIM_MAX_LEVEL; l++) {
+        top_lists[l].init(TOP_REACH_NUM_SHOW);
     }
-    else if(instr_type == MEM_STORE_PROJ0) {
-        gloabl_hndl_call_num = gloabl_hndl_call_num_store;
-        dr_fprintf(gTraceFile, "MEMORY STORE : %d\n", mem_store);
+    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+    paged_table_for_each(gloabl_hndl_cache_miss, max_ctxt_hndl,
+                         [&top_lists](context_handle_t i, cache_miss_t &cache_miss) {
+        for (int32_t l = 0; l < CACHE_SIM_MAX_LEVEL; l++) {
+            if (cache_miss.count[l] > top_lists[l].threshold()) {
+                top_lists[l].push(i, cache_miss.count[l]);
+            }
+        }
+    });
+
+    dr_fprintf(file, "CACHE ACCESSES : %llu (", cache_access_total);
+    for (int32_t l = 0; l < CACHE_SIM_MAX_LEVEL; l++) {
+        dr_fprintf(file, "%s%d KB %d-way", l == 0 ? "" : ", ",
+                   op_cache_config[l].size / 1024, op_cache_config[l].assoc);
     }
-    else if(instr_type == COND_BRANCH_PROJ0) {
-        gloabl_hndl_call_num = gloabl_hndl_call_num_cond;
-        dr_fprintf(gTraceFile, "CONDITIONAL BRANCHES : %d\n", cond_branch);
+    dr_fprintf(file, ", %d B lines)\n", op_cache_line);
+    for (int32_t l = 0; l < CACHE_SIM_MAX_LEVEL; l++) {
+        dr_fprintf(file, "%s : %llu\n", cache_level_name[l], cache_miss_total[l]);
+        top_lists[l].sort();
+        output_format_t *output_list = top_lists[l].list;
+        for (int32_t i = 0; i < top_lists[l].size; i++) {
+            dr_fprintf(file, "[NO. %d]", i + 1);
+            dr_fprintf(file, "Misses %llu\n", output_list[i].count);
+            dr_fprintf(file, "================================================================================\n");
+            drcctlib_print_backtrace(file, output_list[i].handle, true, true, -1);
+            dr_fprintf(file, "================================================================================\n\n");
+        }
+        top_lists[l].free();
     }
-    else if(instr_type == UNCOND_BRANCH_PROJ0) {
-        gloabl_hndl_call_num = gloabl_hndl_call_num_uncond;
-        dr_fprintf(gTraceFile, "UNCONDITIONAL BRANCHES : %d\n", uncond_branch);
+}
+
+// -branch mode: the branches gshare mispredicts most, in the layout of
+// print_calling_context. Branches are not sampled.
+static void
+print_branch_mispredicts(file_t file)
+{
+    top_n_t top_list;
+    top_list.init(TOP_REACH_NUM_SHOW);
+    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+    paged_table_for_each(gloabl_hndl_branch_stat, max_ctxt_hndl,
+                         [&top_list](context_handle_t i, branch_stat_t &branch_stat) {
+        if (branch_stat.miss[BRANCH_MISS_GSHARE] > top_list.threshold()) {
+            top_list.push(i, branch_stat.miss[BRANCH_MISS_GSHARE]);
+        }
+    });
+
+    dr_fprintf(file, "BRANCH MISPREDICTS : %llu gshare, %llu bimodal of %llu\n",
+               branch_miss_total[BRANCH_MISS_GSHARE], branch_miss_total[BRANCH_MISS_BIMODAL],
+               branch_total);
+    top_list.sort();
+    output_format_t *output_list = top_list.list;
+    for (int32_t i = 0; i < top_list.size; i++) {
+        branch_stat_t *branch_stat = gloabl_hndl_branch_stat.find(output_list[i].handle);
+        dr_fprintf(file, "[NO. %d]", i + 1);
+        dr_fprintf(file, "Mispredicts gshare %llu bimodal %llu, taken %llu not taken %llu\n",
+                   branch_stat->miss[BRANCH_MISS_GSHARE],
+                   branch_stat->miss[BRANCH_MISS_BIMODAL], branch_stat->taken,
+                   branch_stat->not_taken);
+        dr_fprintf(file, "================================================================================\n");
+        drcctlib_print_backtrace(file, output_list[i].handle, true, true, -1);
+        dr_fprintf(file, "================================================================================\n\n");
     }
+    top_list.free();
+}
 
-    output_format_t *output_list =
-        (output_format_t *)dr_global_alloc(TOP_REACH_NUM_SHOW * sizeof(output_format_t));
-    for (int32_t i = 0; i < TOP_REACH_NUM_SHOW; i++) {
-        output_list[i].handle = 0; // this is index of gloabl_hndl_call_num
-        output_list[i].count = 0; // this is value of gloabl_hndl_call_num[i]
+// label of a reuse_bin() bin, "COLD", "0" or "<low>-<high>"
+static void
+reuse_bin_label(int32_t bin, char *label, size_t size)
+{
+    if (bin == REUSE_BIN_COLD) {
+        dr_snprintf(label, size, "COLD");
+    } else if (bin == 1) {
+        dr_snprintf(label, size, "0");
+    } else if (bin == REUSE_BIN_NUM - 1) {
+        dr_snprintf(label, size, "%llu+", 1ULL << (bin - 2));
+    } else {
+        dr_snprintf(label, size, "%llu-%llu", 1ULL << (bin - 2), (1ULL << (bin - 1)) - 1);
     }
-    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num(); // get number of contexts in gloabl_hndl_call_num
-    // i think a context is an instruction plus its call path
+    label[size - 1] = '\0';
+}
 
-    for (context_handle_t i = 0; i < max_ctxt_hndl; i++) {
-        if (gloabl_hndl_call_num[i] <= 0) {
-            continue;
+// -reuse mode: the contexts with the most line accesses, each with its distance
+// histogram. Distances are in distinct lines of -cache_line bytes, COLD is the first
+// access or a reuse beyond the window of drcctlib_reuse_distance.h.
+static void
+print_reuse_distances(file_t file)
+{
+    top_n_t top_list;
+    top_list.init(TOP_REACH_NUM_SHOW);
+    uint64_t total = 0;
+    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+    paged_table_for_each(gloabl_hndl_reuse_hist, max_ctxt_hndl,
+                         [&top_list, &total](context_handle_t i, reuse_hist_t &reuse_hist) {
+        uint64_t accesses = 0;
+        for (int32_t b = 0; b < REUSE_BIN_NUM; b++) {
+            accesses += reuse_hist.count[b];
         }
-        if (gloabl_hndl_call_num[i] > output_list[0].count) { // output_list initialized to zeroes
-            uint64_t min_count = gloabl_hndl_call_num[i];
-            int32_t min_idx = 0;
-            // i is index for gloabl_hndl_call_num, j is index for output_list
-            for (int32_t j = 1; j < TOP_REACH_NUM_SHOW; j++) { // TOP_REACH_NUM_SHOW is size of output_list, output_list[0] has least called instr
-                if (output_list[j].count < min_count) {
-                    min_count = output_list[j].count;
-                    min_idx = j;
+        total += accesses;
+        if (accesses > top_list.threshold()) {
+            top_list.push(i, accesses);
+        }
+    });
+
+    dr_fprintf(file, "REUSE DISTANCE (%d B LINES) : %llu\n", op_cache_line, total);
+    top_list.sort();
+    output_format_t *output_list = top_list.list;
+    char label[32];
+    for (int32_t i = 0; i < top_list.size; i++) {
+        dr_fprintf(file, "[NO. %d]", i + 1);
+        dr_fprintf(file, "Line accesses %llu\n", output_list[i].count);
+        reuse_hist_t *reuse_hist = gloabl_hndl_reuse_hist.find(output_list[i].handle);
+        for (int32_t b = 0; b < REUSE_BIN_NUM; b++) {
+            if (reuse_hist->count[b] != 0) {
+                reuse_bin_label(b, label, sizeof(label));
+                dr_fprintf(file, "    %-16s %llu\n", label, reuse_hist->count[b]);
+            }
+        }
+        dr_fprintf(file, "================================================================================\n");
+        drcctlib_print_backtrace(file, output_list[i].handle, true, true, -1);
+        dr_fprintf(file, "================================================================================\n\n");
+    }
+    top_list.free();
+}
+
+// -binary mode: one record with the four estimated counts per context
+static void
+WriteBinaryProfile()
+{
+    char name[MAXIMUM_FILEPATH] = "";
+    DRCCTLIB_INIT_LOG_FILE_NAME(name, "instr_analysis", "bin");
+    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+    if (!binary_profile_write(name, gloabl_hndl_instr_count, max_ctxt_hndl,
+                              INSTR_TYPE_NUM_PROJ0, instr_type_name, op_sample_burst,
+                              op_sample_period,
+                              [](instr_count_t &instr_count, uint64_t *metrics) {
+                                  bool nonzero = false;
+                                  for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+                                      metrics[t] = gSampler.estimate(instr_count.count[t]);
+                                      nonzero |= instr_count.count[t] != 0;
+                                  }
+                                  return nonzero;
+                              })) {
+        DRCCTLIB_PRINTF("ERROR: unable to write %s", name);
+    }
+}
+
+// -drcctprof mode: one pass over the records, every executed context becomes a sample
+// with all metrics
+static void
+WriteDrcctprof()
+{
+    Profile::profile_t *profile = new Profile::profile_t();
+    for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+        profile->add_metric_type(1, "", instr_type_name[t]);
+    }
+    profile->add_metric_type(1, "", "TOTAL");
+    if (op_reuse) {
+        char label[32];
+        char metric_name[64];
+        for (int32_t b = 0; b < REUSE_BIN_NUM; b++) {
+            reuse_bin_label(b, label, sizeof(label));
+            dr_snprintf(metric_name, sizeof(metric_name), "REUSE DISTANCE %s", label);
+            metric_name[sizeof(metric_name) - 1] = '\0';
+            profile->add_metric_type(1, "", metric_name);
+        }
+    }
+
+    context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+    paged_table_for_each(gloabl_hndl_instr_count, max_ctxt_hndl,
+                         [profile](context_handle_t i, instr_count_t &instr_count) {
+        uint64_t total = 0;
+        for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+            total += instr_count.count[t];
+        }
+        if (total == 0) {
+            return;
+        }
+        inner_context_t *cur_ctxt = drcctlib_get_full_cct(i);
+        Profile::sample_t *sample = profile->add_sample(cur_ctxt);
+        for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+            sample->append_metirc(gSampler.estimate(instr_count.count[t]));
+        }
+        sample->append_metirc(gSampler.estimate(total));
+        if (op_reuse) {
+            // not sampled
+            reuse_hist_t *reuse_hist = gloabl_hndl_reuse_hist.find(i);
+            for (int32_t b = 0; b < REUSE_BIN_NUM; b++) {
+                sample->append_metirc(reuse_hist == NULL ? 0 : reuse_hist->count[b]);
+            }
+        }
+        drcctlib_free_full_cct(cur_ctxt);
+    });
+
+    char name[MAXIMUM_FILEPATH] = "";
+    DRCCTLIB_INIT_LOG_FILE_NAME(name, "instr_analysis", "drcctprof");
+    profile->serialize_to_file(name);
+    delete profile;
+}
+
+// Sums the global tables and the tables of the live threads into snapshot_instr_count.
+// merge_lock keeps threads from exiting meanwhile, counting itself is not blocked.
+static void
+TakeSnapshot(context_handle_t max_ctxt_hndl)
+{
+    snapshot_instr_count.clear();
+    dr_mutex_lock(merge_lock);
+    if (op_bb) {
+        memset(snapshot_total, 0, sizeof(snapshot_total));
+        auto add_bb_entry = [](context_handle_t i, uint64_t &entry_num) {
+            uint64_t value = entry_num;
+            if (value != 0) {
+                ExpandBBEntry(snapshot_instr_count, snapshot_total, i, value);
+            }
+        };
+        paged_table_for_each(gloabl_bb_entry_num, max_ctxt_hndl, add_bb_entry);
+        for (per_thread_t *pt = live_threads; pt != NULL; pt = pt->next) {
+            paged_table_for_each(pt->bb_entry_num, max_ctxt_hndl, add_bb_entry);
+        }
+    } else {
+        memcpy(snapshot_total, instr_total, sizeof(snapshot_total));
+        auto add_instr_count = [](context_handle_t i, instr_count_t &instr_count) {
+            for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+                uint64_t value = instr_count.count[t];
+                if (value != 0) {
+                    snapshot_instr_count.get(i).count[t] += value;
                 }
             }
+        };
+        paged_table_for_each(gloabl_hndl_instr_count, max_ctxt_hndl, add_instr_count);
+        for (per_thread_t *pt = live_threads; pt != NULL; pt = pt->next) {
+            for (int32_t t = 0; t < INSTR_TYPE_NUM_PROJ0; t++) {
+                snapshot_total[t] += pt->instr_total[t];
+            }
+            paged_table_for_each(pt->hndl_instr_count, max_ctxt_hndl, add_instr_count);
+        }
+    }
+    dr_mutex_unlock(merge_lock);
+}
 
-            // if gloabl_hndl_call_num > output_list[0].count, iterate all output_list.count and find smallest output_list.count
-            // overwrite output_list[0] with smallest count
-            output_list[0].count = min_count;
-            output_list[0].handle = output_list[min_idx].handle;
-            // min_idx was just moved to 0, overwrite min_idx with gloabl_hndl_call_num[i]
-            // i think this is done because there is limited amount of space in output_list
-            output_list[min_idx].count = gloabl_hndl_call_num[i];
-            output_list[min_idx].handle = i;
-        }
-    }
-
-    // sort
-    output_format_t temp;
-    for (int32_t i = 0; i < TOP_REACH_NUM_SHOW; i++) {
-        for (int32_t j = i; j < TOP_REACH_NUM_SHOW; j++) {
-            if (output_list[i].count < output_list[j].count) {
-                temp = output_list[i];
-                output_list[i] = output_list[j];
-                output_list[j] = temp;
+static void
+SnapshotThread(void *arg)
+{
+    uint64_t start_time = dr_get_milliseconds();
+    for (int32_t snapshot_idx = 1;; snapshot_idx++) {
+        dr_sleep(op_snapshot);
+        // DR must not suspend this thread at exit while it holds merge_lock, which the
+        // exit-time ClientThreadEnd calls need, or with a snapshot half written. The
+        // exit waits until the thread is suspendable again.
+        dr_client_thread_set_suspendable(false);
+        context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+        TakeSnapshot(max_ctxt_hndl);
+        dr_fprintf(gSnapshotFile, "SNAPSHOT %d TIME %llu ms%s\n", snapshot_idx,
+                   dr_get_milliseconds() - start_time, op_snapshot_delta ? " DELTA" : "");
+        if (!op_snapshot_delta) {
+            print_all_calling_contexts(gSnapshotFile, snapshot_instr_count, snapshot_total);
+        } else {
+            // <context handle> <load> <store> <cond> <uncond> since the last snapshot
+            paged_table_for_each(snapshot_instr_count, max_ctxt_hndl,
+                                 [](context_handle_t i, instr_count_t &instr_count) {
+                instr_count_t &last = snapshot_last_instr_count.get(i);
+                if (memcmp(&instr_count, &last, sizeof(instr_count_t)) == 0) {
+                    return;
+                }
+                dr_fprintf(gSnapshotFile, "%d %llu %llu %llu %llu\n", i,
+                           gSampler.estimate(instr_count.count[0] - last.count[0]),
+                           gSampler.estimate(instr_count.count[1] - last.count[1]),
+                           gSampler.estimate(instr_count.count[2] - last.count[2]),
+                           gSampler.estimate(instr_count.count[3] - last.count[3]));
+                last = instr_count;
+            });
+        }
+        dr_fprintf(gSnapshotFile, "END SNAPSHOT %d\n", snapshot_idx);
+        dr_flush_file(gSnapshotFile);
+        dr_client_thread_set_suspendable(true);
+    }
+}
+
+// Options:
+// -bb
+//      Count basic block entries instead of instructions, the per-instruction counts
+//      are rebuilt at exit.
+// -snapshot <ms>
+//      Every <ms> milliseconds a DynamoRIO client thread sums the counter tables and
+//      writes the report to the snapshot file. Application threads never wait for
+//      the file I/O.
+// -snapshot_delta
+//      Write snapshots as "<context handle> <load> <store> <cond> <uncond>" lines
+//      with the counts since the last snapshot.
+// -sample <N>
+//      Each thread counts one in N executions of its instructions (of its blocks
+//      with -bb) on average, at random gaps, see drcctlib_sampling.h. Reported counts are estimates, the count
+//      times N.
+// -sample_burst <ON> <OFF>
+//      Count ON consecutive executions, then skip OFF on average. Counts are scaled by
+//      (ON + OFF) / ON.
+// -binary
+//      Dump the counters, the CCT above them and the module list into
+//      instr_analysis.bin at exit instead of printing backtraces, see
+//      binary_profile_view.py.
+// -drcctprof
+//      Also write instr_analysis.drcctprof, one sample per context carrying the load,
+//      store, conditional and unconditional branch counts and their sum, for the
+//      DrCCTProf viewers.
+// -memtrace
+//      Also write every memory access as <context handle, size, load/store, address>
+//      into instr_analysis.memtrace, see memtrace_view.py. The trace is complete,
+//      sampling only applies to the counters.
+// -cache
+//      Run the memory accesses of each thread through a simulated L1/LLC hierarchy,
+//      see drcctlib_cache_sim.h, and append the contexts with the most misses per
+//      level to the report. Like the trace, the simulation is not sampled.
+// -cache_l1 <KB> <ways>, -cache_llc <KB> <ways>, -cache_line <bytes>
+//      Geometry of the simulated caches, 32 KB 8-way, 2048 KB 16-way and 64 B by
+//      default. Line size and set counts must be powers of two.
+// -reuse
+//      Histogram of the reuse distances, in distinct -cache_line lines, of the
+//      accesses of every context, see drcctlib_reuse_distance.h. Reported after the
+//      instruction counts and, with -drcctprof, as one metric per bin. Not sampled.
+// -branch
+//      Record the direction of every conditional branch per context and run it
+//      through a bimodal and a gshare predictor, see drcctlib_branch_predictor.h.
+//      The report ranks the branches by gshare mispredictions. Not sampled, the
+//      predictors need the whole branch stream.
+// -roi
+//      Only count, trace and simulate inside the regions the target marks with
+//      p0_roi.h, see drcctlib_roi.h. Code outside runs without instrumentation
+//      beyond drcctlib's call path tracking.
+static void
+ClientParseOptions(int argc, const char *argv[])
+{
+    // argv[0] is the client library path
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-bb") == 0) {
+            op_bb = true;
+        } else if (strcmp(argv[i], "-snapshot") == 0 && i + 1 < argc) {
+            op_snapshot = atoi(argv[++i]);
+            if (op_snapshot <= 0) {
+                DRCCTLIB_EXIT_PROCESS("-snapshot needs a positive period in ms");
+            }
+        } else if (strcmp(argv[i], "-snapshot_delta") == 0) {
+            op_snapshot_delta = true;
+        } else if (strcmp(argv[i], "-binary") == 0) {
+            op_binary = true;
+        } else if (strcmp(argv[i], "-drcctprof") == 0) {
+            op_drcctprof = true;
+        } else if (strcmp(argv[i], "-memtrace") == 0) {
+            op_memtrace = true;
+        } else if (strcmp(argv[i], "-cache") == 0) {
+            op_cache = true;
+        } else if (strcmp(argv[i], "-reuse") == 0) {
+            op_reuse = true;
+        } else if (strcmp(argv[i], "-branch") == 0) {
+            op_branch = true;
+        } else if (strcmp(argv[i], "-roi") == 0) {
+            op_roi = true;
+        } else if ((strcmp(argv[i], "-cache_l1") == 0 ||
+                    strcmp(argv[i], "-cache_llc") == 0) &&
+                   i + 2 < argc) {
+            int32_t level = strcmp(argv[i], "-cache_l1") == 0 ? 0 : 1;
+            cache_config_t &config = op_cache_config[level];
+            config.size = atoi(argv[++i]) * 1024;
+            config.assoc = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-cache_line") == 0 && i + 1 < argc) {
+            op_cache_line = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-sample") == 0 && i + 1 < argc) {
+            op_sample_period = atoi(argv[++i]);
+            op_sample_burst = 1;
+            if (op_sample_period <= 0) {
+                DRCCTLIB_EXIT_PROCESS("-sample needs a positive period");
+            }
+        } else if (strcmp(argv[i], "-sample_burst") == 0 && i + 2 < argc) {
+            op_sample_burst = atoi(argv[++i]);
+            int32_t off = atoi(argv[++i]);
+            if (op_sample_burst <= 0 || off < 0) {
+                DRCCTLIB_EXIT_PROCESS("-sample_burst needs a positive ON and OFF >= 0");
             }
+            op_sample_period = op_sample_burst + off;
+        } else {
+            DRCCTLIB_EXIT_PROCESS("unknown client option %s", argv[i]);
         }
     }
+    if (op_cache &&
+        !cache_sim_t::valid_config(op_cache_config, CACHE_SIM_MAX_LEVEL, op_cache_line)) {
+        DRCCTLIB_EXIT_PROCESS("-cache needs power-of-two line sizes and set counts");
+    }
+    if (op_reuse && !cache_sim_t::valid_config(NULL, 0, op_cache_line)) {
+        DRCCTLIB_EXIT_PROCESS("-reuse needs a power-of-two -cache_line");
+    }
+}
 
-    // print output
-    for (int32_t i = 0; i < TOP_REACH_NUM_SHOW; i++) {
-        if (output_list[i].handle == 0) {
-            break;
+static void
+ClientInit(int argc, const char *argv[])
+{
+    ClientParseOptions(argc, argv);
+
+    char name[MAXIMUM_FILEPATH] = "";
+    DRCCTLIB_INIT_LOG_FILE_NAME(
+        name, "instr_analysis", "out");
+    DRCCTLIB_PRINTF("Creating log file at:%s", name);
+
+    gTraceFile = dr_open_file(name, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+    DR_ASSERT(gTraceFile != INVALID_FILE);
+
+    InitGlobalBuff();
+
+    if (!drmgr_init()) {
+        DRCCTLIB_EXIT_PROCESS("ERROR: instr_analysis unable to init drmgr");
+    }
+    tls_idx = drmgr_register_tls_field();
+    if (tls_idx == -1) {
+        DRCCTLIB_EXIT_PROCESS("ERROR: instr_analysis drmgr_register_tls_field fail");
+    }
+    merge_lock = dr_mutex_create();
+    drmgr_register_thread_init_event(ClientThreadStart);
+    drmgr_register_thread_exit_event(ClientThreadEnd);
+
+    // with period 1 estimate() is the identity
+    if (!gSampler.init(op_sample_period, op_sample_burst)) {
+        DRCCTLIB_EXIT_PROCESS("ERROR: instr_analysis unable to allocate raw TLS");
+    }
+    if (op_sample_period > 1 || op_memtrace || op_cache || op_reuse) {
+        // the inlined sampling check needs the flags, the memory trace three registers
+        drreg_options_t ops = { sizeof(ops), 4 /*max slots needed*/, false };
+        if (drreg_init(&ops) != DRREG_SUCCESS) {
+            DRCCTLIB_EXIT_PROCESS("ERROR: instr_analysis unable to init drreg");
+        }
+    }
+
+    if (op_memtrace || op_cache || op_reuse) {
+        if (!drutil_init() || !drx_init()) {
+            DRCCTLIB_EXIT_PROCESS("ERROR: instr_analysis unable to init drutil/drx");
+        }
+        gMemTraceBuf = drx_buf_create_trace_buffer(MEM_TRACE_BUF_SIZE, MemTraceBufFull);
+        if (gMemTraceBuf == NULL) {
+            DRCCTLIB_EXIT_PROCESS("ERROR: instr_analysis unable to create the trace buffer");
+        }
+    }
+    if (op_cache && !gloabl_hndl_cache_miss.init(false)) {
+        DRCCTLIB_EXIT_PROCESS("ERROR: cache miss table dr_raw_mem_alloc fail");
+    }
+    if (op_reuse && !gloabl_hndl_reuse_hist.init(false)) {
+        DRCCTLIB_EXIT_PROCESS("ERROR: reuse histogram table dr_raw_mem_alloc fail");
+    }
+    if (op_branch && !gloabl_hndl_branch_stat.init(false)) {
+        DRCCTLIB_EXIT_PROCESS("ERROR: branch table dr_raw_mem_alloc fail");
+    }
+    if (op_memtrace) {
+        mem_trace_lock = dr_mutex_create();
+        DRCCTLIB_INIT_LOG_FILE_NAME(name, "instr_analysis", "memtrace");
+        gMemTraceFile = dr_open_file(name, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+        DR_ASSERT(gMemTraceFile != INVALID_FILE);
+    }
+
+    if (op_snapshot > 0) {
+        DRCCTLIB_INIT_LOG_FILE_NAME(name, "instr_analysis_snapshot", "out");
+        gSnapshotFile = dr_open_file(name, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+        DR_ASSERT(gSnapshotFile != INVALID_FILE);
+        if (!snapshot_instr_count.init(false) || !snapshot_last_instr_count.init(false)) {
+            DRCCTLIB_EXIT_PROCESS("ERROR: snapshot tables dr_raw_mem_alloc fail");
+        }
+        if (!dr_create_client_thread(SnapshotThread, NULL)) {
+            DRCCTLIB_EXIT_PROCESS("ERROR: unable to create the snapshot thread");
         }
-        dr_fprintf(gTraceFile, "[NO. %d]", i + 1);
-        dr_fprintf(gTraceFile, "Ins call times %lld\n",
-                   output_list[i].count);
-        dr_fprintf(gTraceFile, "================================================================================\n");
-        drcctlib_print_backtrace(gTraceFile, output_list[i].handle, true, true, -1);
-        dr_fprintf(gTraceFile, "================================================================================\n\n");
-        
-        
     }
-    dr_global_free(output_list, TOP_REACH_NUM_SHOW * sizeof(output_format_t));
+
+    gRoi.init(op_roi);
+    drcctlib_init(RoiFilter, INVALID_FILE, InsTransEventCallback, false);
 }
 
 static void
 ClientExit(void)
 {
-    for(int i = 0; i < 4; i++)
-        print_calling_context(i);
+    if (op_bb) {
+        ExpandBBCount();
+    }
+    if (op_binary) {
+        WriteBinaryProfile();
+    } else {
+        print_all_calling_contexts(gTraceFile, gloabl_hndl_instr_count, instr_total);
+    }
+    if (op_reuse) {
+        print_reuse_distances(gTraceFile);
+    }
+    if (op_branch) {
+        print_branch_mispredicts(gTraceFile);
+    }
+    if (op_drcctprof) {
+        WriteDrcctprof();
+    }
+    if (op_cache) {
+        print_cache_misses(gTraceFile);
+    }
 
+    if (op_snapshot > 0) {
+        // the snapshot thread is suspended between two snapshots by now, so the file
+        // ends with a complete one. Its tables are left to the process exit.
+        dr_close_file(gSnapshotFile);
+    }
     FreeGlobalBuff();
+    gSampler.free();
     drcctlib_exit();
+    gRoi.free();
+    if (op_memtrace || op_cache || op_reuse) {
+        // every thread has flushed its buffer by now
+        drx_buf_free(gMemTraceBuf);
+        drx_exit();
+        drutil_exit();
+    }
+    if (op_memtrace) {
+        dr_mutex_destroy(mem_trace_lock);
+        dr_close_file(gMemTraceFile);
+    }
+    if (op_cache) {
+        gloabl_hndl_cache_miss.free();
+    }
+    if (op_reuse) {
+        gloabl_hndl_reuse_hist.free();
+    }
+    if (op_branch) {
+        gloabl_hndl_branch_stat.free();
+    }
+    if (op_sample_period > 1 || op_memtrace || op_cache || op_reuse) {
+        drreg_exit();
+    }
+
+    drmgr_unregister_thread_init_event(ClientThreadStart);
+    drmgr_unregister_thread_exit_event(ClientThreadEnd);
+    drmgr_unregister_tls_field(tls_idx);
+    dr_mutex_destroy(merge_lock);
+    drmgr_exit();
 
     dr_close_file(gTraceFile);
 }
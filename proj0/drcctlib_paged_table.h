@@ -0,0 +1,157 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_paged_table.h
+ *
+ * Two-level table indexed by context_handle_t that the proj0 clients use instead of
+ * CONTEXT_HANDLE_MAX sized arrays. The directory is allocated up front, a page of
+ * entries is only allocated when a handle in its range is first written, so memory and
+ * the exit scan both follow the number of contexts that actually executed.
+ *
+ * Other threads, e.g. a snapshot thread, may read a table while its owner allocates
+ * pages. A page is zeroed before alloc_page() publishes it with a release store and
+ * every read of the directory is an acquire load, so a reader never sees a page before
+ * its zeroes. On x86 both are plain moves, which is also all the inlined directory
+ * load of instr_statistics_clean_call does.
+ */
+
+#ifndef _DRCCTLIB_PAGED_TABLE_H_
+#define _DRCCTLIB_PAGED_TABLE_H_
+
+#include <string.h>
+
+#include "dr_api.h"
+#include "drcctlib.h"
+
+#define PAGED_TABLE_PAGE_BITS 12
+#define PAGED_TABLE_PAGE_ENTRIES (1 << PAGED_TABLE_PAGE_BITS)
+#define PAGED_TABLE_PAGE_MASK (PAGED_TABLE_PAGE_ENTRIES - 1)
+#define PAGED_TABLE_DIR_ENTRIES \
+    ((CONTEXT_HANDLE_MAX + PAGED_TABLE_PAGE_ENTRIES - 1) >> PAGED_TABLE_PAGE_BITS)
+
+template <typename T> struct paged_table_t {
+    // pages[i] holds the entries of handles [i << PAGED_TABLE_PAGE_BITS, (i + 1) <<
+    // PAGED_TABLE_PAGE_BITS), NULL until one of them is written. Access it through
+    // load_page() and alloc_page().
+    T **pages;
+    // only set for tables written by several threads
+    void *lock;
+
+    bool
+    init(bool shared)
+    {
+        pages = (T **)dr_raw_mem_alloc(PAGED_TABLE_DIR_ENTRIES * sizeof(T *),
+                                                DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+        lock = shared ? dr_mutex_create() : NULL;
+        return pages != NULL;
+    }
+
+    void
+    free()
+    {
+        for (int32_t i = 0; i < PAGED_TABLE_DIR_ENTRIES; i++) {
+            T *page = load_page(i);
+            if (page != NULL) {
+                dr_raw_mem_free(page, PAGED_TABLE_PAGE_ENTRIES * sizeof(T));
+            }
+        }
+        dr_raw_mem_free((void *)pages, PAGED_TABLE_DIR_ENTRIES * sizeof(T *));
+        if (lock != NULL) {
+            dr_mutex_destroy(lock);
+        }
+    }
+
+    // zeroes the populated pages, they stay allocated
+    void
+    clear()
+    {
+        for (int32_t i = 0; i < PAGED_TABLE_DIR_ENTRIES; i++) {
+            T *page = load_page(i);
+            if (page != NULL) {
+                memset(page, 0, PAGED_TABLE_PAGE_ENTRIES * sizeof(T));
+            }
+        }
+    }
+
+    // page of directory entry page_idx, NULL if it is not allocated yet
+    inline T *
+    load_page(int32_t page_idx) const
+    {
+        return __atomic_load_n(&pages[page_idx], __ATOMIC_ACQUIRE);
+    }
+
+    // slow path of get(), also called from inlined instrumentation
+    T *
+    alloc_page(int32_t page_idx)
+    {
+        if (lock != NULL) {
+            dr_mutex_lock(lock);
+        }
+        T *page = load_page(page_idx);
+        if (page == NULL) {
+            page = (T *)dr_raw_mem_alloc(PAGED_TABLE_PAGE_ENTRIES * sizeof(T),
+                                         DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+            if (page == NULL) {
+                dr_fprintf(STDERR, "paged_table_t: dr_raw_mem_alloc fail\n");
+                dr_abort();
+            }
+            memset(page, 0, PAGED_TABLE_PAGE_ENTRIES * sizeof(T));
+            __atomic_store_n(&pages[page_idx], page, __ATOMIC_RELEASE);
+        }
+        if (lock != NULL) {
+            dr_mutex_unlock(lock);
+        }
+        return page;
+    }
+
+    // entry for writing, the page is allocated on first use
+    inline T &
+    get(context_handle_t handle)
+    {
+        int32_t page_idx = handle >> PAGED_TABLE_PAGE_BITS;
+        T *page = load_page(page_idx);
+        if (page == NULL) {
+            page = alloc_page(page_idx);
+        }
+        return page[handle & PAGED_TABLE_PAGE_MASK];
+    }
+
+    // entry for reading, NULL if nothing in its page was ever written
+    inline T *
+    find(context_handle_t handle) const
+    {
+        T *page = load_page(handle >> PAGED_TABLE_PAGE_BITS);
+        return page == NULL ? NULL : &page[handle & PAGED_TABLE_PAGE_MASK];
+    }
+
+    // number of directory entries that can hold handles below max_ctxt_hndl
+    static inline int32_t
+    page_num(context_handle_t max_ctxt_hndl)
+    {
+        return (max_ctxt_hndl + PAGED_TABLE_PAGE_MASK) >> PAGED_TABLE_PAGE_BITS;
+    }
+};
+
+// Calls func(handle, entry) for every entry of a populated page below max_ctxt_hndl.
+template <typename T, typename F>
+static inline void
+paged_table_for_each(paged_table_t<T> &table, context_handle_t max_ctxt_hndl, F func)
+{
+    int32_t page_num = paged_table_t<T>::page_num(max_ctxt_hndl);
+    for (int32_t i = 0; i < page_num; i++) {
+        T *page = table.load_page(i);
+        if (page == NULL) {
+            continue;
+        }
+        context_handle_t base = i << PAGED_TABLE_PAGE_BITS;
+        for (int32_t j = 0; j < PAGED_TABLE_PAGE_ENTRIES && base + j < max_ctxt_hndl;
+             j++) {
+            func(base + j, page[j]);
+        }
+    }
+}
+
+#endif // _DRCCTLIB_PAGED_TABLE_H_
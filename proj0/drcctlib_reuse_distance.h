@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_reuse_distance.h
+ *
+ * Reuse distance, the number of distinct cache lines touched between two accesses to
+ * the same line, for the proj0 clients. Every access gets a timestamp, a Fenwick tree
+ * over the timestamps holds a 1 at the last access of each line, so the distance is
+ * the sum over the timestamps after the line's previous access: O(log window) per
+ * access instead of the O(distance) of an LRU stack.
+ *
+ * Timestamps live in a window of capacity slots. When it is used up, the lines are
+ * renumbered in access order and only the most recent capacity / 2 are kept. Lines
+ * that drop out count as cold on their next access, so distances from capacity / 2
+ * on are approximate. The distances go into log2 bins, see reuse_bin().
+ *
+ * Not thread safe, the clients keep one instance per thread.
+ */
+
+#ifndef _DRCCTLIB_REUSE_DISTANCE_H_
+#define _DRCCTLIB_REUSE_DISTANCE_H_
+
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dr_api.h"
+
+#define REUSE_WINDOW_BITS 20
+// cold, distance 0, then [2^k, 2^(k+1)) for k < REUSE_WINDOW_BITS
+#define REUSE_BIN_NUM (REUSE_WINDOW_BITS + 2)
+#define REUSE_BIN_COLD 0
+
+// bin of a distance from reuse_distance_t::access()
+static inline int32_t
+reuse_bin(int64_t distance)
+{
+    if (distance < 0) {
+        return REUSE_BIN_COLD;
+    }
+    if (distance == 0) {
+        return 1;
+    }
+    int32_t bin = 2 + 63 - __builtin_clzll((uint64_t)distance);
+    return bin < REUSE_BIN_NUM ? bin : REUSE_BIN_NUM - 1;
+}
+
+struct reuse_distance_t {
+    int32_t capacity;
+    // Fenwick tree over the timestamps of the window
+    int32_t *tree;
+    int32_t now;
+    // line -> timestamp of its last access
+    std::unordered_map<uint64_t, int32_t> *last_access;
+
+    void
+    init()
+    {
+        capacity = 1 << REUSE_WINDOW_BITS;
+        tree = (int32_t *)dr_global_alloc(capacity * sizeof(int32_t));
+        memset(tree, 0, capacity * sizeof(int32_t));
+        now = 0;
+        last_access = new std::unordered_map<uint64_t, int32_t>();
+    }
+
+    void
+    free()
+    {
+        dr_global_free(tree, capacity * sizeof(int32_t));
+        delete last_access;
+    }
+
+    // Distinct lines since the last access to line, -1 on the first access.
+    inline int64_t
+    access(uint64_t line)
+    {
+        if (now == capacity) {
+            compact();
+        }
+        int64_t distance = -1;
+        auto it = last_access->find(line);
+        if (it == last_access->end()) {
+            last_access->emplace(line, now);
+        } else {
+            distance = prefix_sum(now) - prefix_sum(it->second + 1);
+            add(it->second, -1);
+            it->second = now;
+        }
+        add(now, 1);
+        now++;
+        return distance;
+    }
+
+private:
+    inline void
+    add(int32_t time, int32_t delta)
+    {
+        for (int32_t i = time + 1; i <= capacity; i += i & -i) {
+            tree[i - 1] += delta;
+        }
+    }
+
+    // sum over the timestamps [0, time)
+    inline int32_t
+    prefix_sum(int32_t time) const
+    {
+        int32_t sum = 0;
+        for (int32_t i = time; i > 0; i -= i & -i) {
+            sum += tree[i - 1];
+        }
+        return sum;
+    }
+
+    void
+    compact()
+    {
+        std::vector<std::pair<int32_t, uint64_t>> order;
+        order.reserve(last_access->size());
+        for (auto &entry : *last_access) {
+            order.push_back(std::make_pair(entry.second, entry.first));
+        }
+        std::sort(order.begin(), order.end());
+        size_t keep = std::min(order.size(), (size_t)capacity / 2);
+        size_t drop = order.size() - keep;
+        for (size_t i = 0; i < drop; i++) {
+            last_access->erase(order[i].second);
+        }
+        memset(tree, 0, capacity * sizeof(int32_t));
+        for (size_t i = 0; i < keep; i++) {
+            (*last_access)[order[drop + i].second] = (int32_t)i;
+            add((int32_t)i, 1);
+        }
+        now = (int32_t)keep;
+    }
+};
+
+#endif // _DRCCTLIB_REUSE_DISTANCE_H_
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_roi.h
+ *
+ * Region-of-interest profiling for the proj0 clients, the target marks the region with
+ * the P0_ROI_START()/P0_ROI_STOP() markers of p0_roi.h. While no region is open,
+ * filter() only lets the markers through to drcctlib, so neither the client nor
+ * drcctlib adds per-instruction code, only drcctlib's call path tracking stays.
+ *
+ * A marker is replaced by a clean call that updates the nesting depth. When the depth
+ * leaves or reaches 0 the whole code cache is flushed, so every block is translated
+ * again under the new state, and execution continues after the marker through
+ * dr_redirect_execution, the block the call is in may be gone. Flushes synchronize all
+ * threads, regions should be entered rarely.
+ *
+ * Without -roi active() is always true and no instruction is a marker.
+ */
+
+#ifndef _DRCCTLIB_ROI_H_
+#define _DRCCTLIB_ROI_H_
+
+#include "dr_api.h"
+#include "drcctlib.h"
+
+#define ROI_MARKER_NONE 0
+#define ROI_MARKER_START 1
+#define ROI_MARKER_STOP 2
+
+struct roi_t {
+    bool enabled;
+    // open regions of all threads
+    volatile int32_t depth;
+    void *lock;
+
+    void
+    init(bool enable)
+    {
+        enabled = enable;
+        depth = 0;
+        lock = dr_mutex_create();
+    }
+
+    void
+    free()
+    {
+        dr_mutex_destroy(lock);
+    }
+
+    inline bool
+    active() const
+    {
+        return !enabled || depth > 0;
+    }
+
+    // xchg xbx, xbx starts and xchg xcx, xcx stops a region
+    inline int32_t
+    marker(instr_t *instr) const
+    {
+#ifndef ARM_CCTLIB
+        if (!enabled || instr_get_opcode(instr) != OP_xchg) {
+            return ROI_MARKER_NONE;
+        }
+        opnd_t src = instr_get_src(instr, 0);
+        opnd_t dst = instr_get_dst(instr, 0);
+        if (!opnd_is_reg(src) || !opnd_is_reg(dst) ||
+            opnd_get_reg(src) != opnd_get_reg(dst)) {
+            return ROI_MARKER_NONE;
+        }
+        if (opnd_get_reg(src) == DR_REG_XBX) {
+            return ROI_MARKER_START;
+        }
+        if (opnd_get_reg(src) == DR_REG_XCX) {
+            return ROI_MARKER_STOP;
+        }
+#endif
+        return ROI_MARKER_NONE;
+    }
+
+    // the drcctlib_init filter
+    inline bool
+    filter(instr_t *instr) const
+    {
+        return active() || marker(instr) != ROI_MARKER_NONE;
+    }
+
+    // Inserts a clean call to callee(marker, pc after the marker) before the marker,
+    // callee has to call update().
+    void
+    insert_marker_call(void *drcontext, instrlist_t *bb, instr_t *instr, int32_t type,
+                       void *callee)
+    {
+        app_pc next_pc = instr_get_app_pc(instr) + instr_length(drcontext, instr);
+        dr_insert_clean_call(drcontext, bb, instr, callee, true, 2,
+                             OPND_CREATE_INT32(type),
+                             OPND_CREATE_INTPTR((ptr_int_t)next_pc));
+    }
+
+    // Does not return when the code cache was flushed.
+    void
+    update(int32_t type, app_pc next_pc)
+    {
+        dr_mutex_lock(lock);
+        bool was_active = depth > 0;
+        if (type == ROI_MARKER_START) {
+            depth++;
+        } else if (depth > 0) {
+            depth--;
+        }
+        bool is_active = depth > 0;
+        dr_mutex_unlock(lock);
+        if (was_active == is_active) {
+            return;
+        }
+        void *drcontext = dr_get_current_drcontext();
+        dr_mcontext_t mcontext = { sizeof(mcontext), DR_MC_ALL };
+        dr_get_mcontext(drcontext, &mcontext);
+        dr_flush_region(NULL, ~(size_t)0);
+        mcontext.pc = next_pc;
+        dr_redirect_execution(&mcontext);
+    }
+};
+
+#endif // _DRCCTLIB_ROI_H_
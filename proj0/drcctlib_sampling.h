@@ -0,0 +1,139 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_sampling.h
+ *
+ * Per-thread sampling for the proj0 clients. A thread has one countdown shared by all
+ * of its instrumented points. It counts a burst of consecutive executions, of whichever
+ * points run, then skips a random number of them, uniform in [0, 2 * (period - burst)],
+ * so on average burst out of every period executions are counted. burst == 1 gives
+ * single samples, burst > 1 on/off windows. A fixed gap would land every sample on the
+ * same point of a loop whose body has a number of points that divides the period.
+ *
+ * On x86 the countdown lives in a raw TLS slot and is decremented by two inlined
+ * instructions, the clean call that counts only runs for sampled executions:
+ *
+ *      sub   dword ptr [seg:countdown], 1
+ *      jge   skip
+ *      <clean call, which calls sampled()>
+ *  skip:
+ *
+ * ARM has no inline check, there sampled() does the countdown inside the clean call.
+ * Counts are scaled back with estimate(). Clients using insert_clean_call() need drreg.
+ */
+
+#ifndef _DRCCTLIB_SAMPLING_H_
+#define _DRCCTLIB_SAMPLING_H_
+
+#include "dr_api.h"
+#include "drreg.h"
+#include "drcctlib.h"
+
+struct sampler_t {
+    int32_t period;
+    int32_t burst;
+    // raw TLS slot 0: executions left to skip, slot 1: samples left in the burst, slot
+    // 2: random state of the gaps. All start as 0 in every thread, so the first
+    // execution is always sampled.
+    reg_id_t tls_seg;
+    uint tls_offs;
+
+    bool
+    init(int32_t sample_period, int32_t sample_burst)
+    {
+        period = sample_period;
+        burst = sample_burst;
+        return dr_raw_tls_calloc(&tls_seg, &tls_offs, 3, 0);
+    }
+
+    void
+    free()
+    {
+        dr_raw_tls_cfree(tls_offs, 3);
+    }
+
+    // Inserts a clean call to callee(arg) that only runs for sampled executions. On
+    // x86 the check is inlined, drreg spills the flags only if they are live.
+    void
+    insert_clean_call(void *drcontext, instrlist_t *bb, instr_t *where, void *callee,
+                      opnd_t arg)
+    {
+#ifndef ARM_CCTLIB
+        instr_t *skip = INSTR_CREATE_label(drcontext);
+        if (drreg_reserve_aflags(drcontext, bb, where) != DRREG_SUCCESS) {
+            dr_fprintf(STDERR, "sampler_t: drreg_reserve_aflags fail\n");
+            dr_abort();
+        }
+        instrlist_meta_preinsert(
+            bb, where,
+            INSTR_CREATE_sub(drcontext,
+                             opnd_create_far_base_disp(tls_seg, DR_REG_NULL, DR_REG_NULL,
+                                                       0, tls_offs, OPSZ_4),
+                             OPND_CREATE_INT8(1)));
+        instrlist_meta_preinsert(bb, where,
+                                 INSTR_CREATE_jcc(drcontext, OP_jge, opnd_create_instr(skip)));
+        dr_insert_clean_call(drcontext, bb, where, callee, false, 1, arg);
+        instrlist_meta_preinsert(bb, where, skip);
+        if (drreg_unreserve_aflags(drcontext, bb, where) != DRREG_SUCCESS) {
+            dr_fprintf(STDERR, "sampler_t: drreg_unreserve_aflags fail\n");
+            dr_abort();
+        }
+#else
+        dr_insert_clean_call(drcontext, bb, where, callee, false, 1, arg);
+#endif
+    }
+
+    // Called first in the counting clean call, returns false if the execution is not
+    // sampled. Also sets up the countdown to the next sample.
+    inline bool
+    sampled()
+    {
+        byte *tls = (byte *)dr_get_dr_segment_base(tls_seg) + tls_offs;
+        int32_t *countdown = (int32_t *)tls;
+        ptr_int_t *burst_left = (ptr_int_t *)(tls + sizeof(void *));
+        ptr_uint_t *random = (ptr_uint_t *)(tls + 2 * sizeof(void *));
+#ifdef ARM_CCTLIB
+        if (--(*countdown) >= 0) {
+            return false;
+        }
+#endif
+        if (*burst_left == 0) {
+            *burst_left = burst;
+        }
+        (*burst_left)--;
+        *countdown = *burst_left > 0 ? 0 : gap(random, tls);
+        return true;
+    }
+
+    // executions to skip after a burst, uniform in [0, 2 * (period - burst)]
+    inline int32_t
+    gap(ptr_uint_t *random, byte *tls) const
+    {
+        uint64_t mean = period - burst;
+        if (mean == 0) {
+            return 0;
+        }
+        // xorshift64, seeded by the TLS address, which differs between threads
+        uint64_t x = *random;
+        if (x == 0) {
+            x = 0x9e3779b97f4a7c15ull ^ (uint64_t)(ptr_uint_t)tls;
+        }
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        *random = (ptr_uint_t)x;
+        return (int32_t)(x % (2 * mean + 1));
+    }
+
+    // estimated number of executions behind count samples
+    inline uint64_t
+    estimate(uint64_t count) const
+    {
+        return count * period / burst;
+    }
+};
+
+#endif // _DRCCTLIB_SAMPLING_H_
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2020-2021 Xuhpclab. All rights reserved.
+ *  Licensed under the MIT License.
+ *  See LICENSE file for more information.
+ */
+
+/* drcctlib_top_n.h
+ *
+ * Top-N selection for the exit reports of the proj0 clients. Candidates go through a
+ * size N min-heap, so a scan over M contexts costs O(M log N) and N can be in the
+ * thousands.
+ */
+
+#ifndef _DRCCTLIB_TOP_N_H_
+#define _DRCCTLIB_TOP_N_H_
+
+#include <algorithm>
+
+#include "dr_api.h"
+#include "drcctlib.h"
+
+typedef struct _output_format_t {
+    context_handle_t handle;
+    uint64_t count;
+} output_format_t;
+
+struct top_n_t {
+    // min-heap on count while collecting, sorted by count descending after sort()
+    output_format_t *list;
+    int32_t capacity;
+    int32_t size;
+
+    void
+    init(int32_t n)
+    {
+        list = (output_format_t *)dr_global_alloc(n * sizeof(output_format_t));
+        capacity = n;
+        size = 0;
+    }
+
+    void
+    free()
+    {
+        dr_global_free(list, capacity * sizeof(output_format_t));
+    }
+
+    // smallest count that push() still accepts
+    inline uint64_t
+    threshold() const
+    {
+        return size < capacity ? 0 : list[0].count;
+    }
+
+    inline void
+    push(context_handle_t handle, uint64_t count)
+    {
+        if (size < capacity) {
+            list[size].handle = handle;
+            list[size].count = count;
+            size++;
+            sift_up(size - 1);
+        } else if (count > list[0].count) {
+            list[0].handle = handle;
+            list[0].count = count;
+            sift_down(0);
+        }
+    }
+
+    // largest count first, ties by handle so reports are stable
+    void
+    sort()
+    {
+        std::sort(list, list + size, [](const output_format_t &a, const output_format_t &b) {
+            return a.count != b.count ? a.count > b.count : a.handle < b.handle;
+        });
+    }
+
+private:
+    inline void
+    sift_up(int32_t i)
+    {
+        while (i > 0) {
+            int32_t parent = (i - 1) / 2;
+            if (list[parent].count <= list[i].count) {
+                break;
+            }
+            std::swap(list[parent], list[i]);
+            i = parent;
+        }
+    }
+
+    inline void
+    sift_down(int32_t i)
+    {
+        for (;;) {
+            int32_t smallest = i;
+            int32_t left = 2 * i + 1;
+            int32_t right = left + 1;
+            if (left < size && list[left].count < list[smallest].count) {
+                smallest = left;
+            }
+            if (right < size && list[right].count < list[smallest].count) {
+                smallest = right;
+            }
+            if (smallest == i) {
+                break;
+            }
+            std::swap(list[smallest], list[i]);
+            i = smallest;
+        }
+    }
+};
+
+#endif // _DRCCTLIB_TOP_N_H_
@@ -0,0 +1,22 @@
+/* Stand-ins for the DynamoRIO calls drcctlib_heavy_hitter.h makes, so that
+ * heavy_hitter_check.cpp builds without DynamoRIO. */
+
+#ifndef _HEAVY_HITTER_CHECK_DR_API_H_
+#define _HEAVY_HITTER_CHECK_DR_API_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static inline void *
+dr_global_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+static inline void
+dr_global_free(void *ptr, size_t size)
+{
+    free(ptr);
+}
+
+#endif // _HEAVY_HITTER_CHECK_DR_API_H_
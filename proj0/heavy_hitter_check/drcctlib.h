@@ -0,0 +1,8 @@
+/* Stand-in for drcctlib.h, see dr_api.h. */
+
+#ifndef _HEAVY_HITTER_CHECK_DRCCTLIB_H_
+#define _HEAVY_HITTER_CHECK_DRCCTLIB_H_
+
+typedef int32_t context_handle_t;
+
+#endif // _HEAVY_HITTER_CHECK_DRCCTLIB_H_
@@ -0,0 +1,116 @@
+// Checks drcctlib_heavy_hitter.h against exact counts: skewed streams of context
+// handles are split over several sketches, as the threads of
+// instr_statistics_clean_call split them, and every sketch and their merge must keep
+// the error bounds of the header:
+//   count - error <= exact <= count, error <= N / K, every handle above N / K monitored
+//
+//   g++ -O2 -std=c++11 -I. heavy_hitter_check.cpp -o heavy_hitter_check && ./heavy_hitter_check
+//
+// Exits with 1 and prints the first violations if a bound does not hold.
+
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+#include "../drcctlib_heavy_hitter.h"
+
+static int violation_num = 0;
+
+static void
+Violation(const char *what, int round, context_handle_t handle, uint64_t exact,
+          const heavy_hitter_entry_t *entry)
+{
+    if (violation_num++ < 10) {
+        printf("round %d handle %d: %s, exact %llu count %llu error %llu\n", round, handle,
+               what, (unsigned long long)exact,
+               entry == NULL ? 0ULL : (unsigned long long)entry->count,
+               entry == NULL ? 0ULL : (unsigned long long)entry->error);
+    }
+}
+
+// entries against the exact counts of a stream of total updates
+static void
+CheckBounds(int round, const heavy_hitter_entry_t *entries, int32_t size,
+            const std::map<context_handle_t, uint64_t> &exact, uint64_t total, int32_t k)
+{
+    std::map<context_handle_t, const heavy_hitter_entry_t *> monitored;
+    for (int32_t i = 0; i < size; i++) {
+        if (monitored.count(entries[i].handle) != 0) {
+            Violation("handle listed twice", round, entries[i].handle, 0, &entries[i]);
+        }
+        monitored[entries[i].handle] = &entries[i];
+        auto it = exact.find(entries[i].handle);
+        uint64_t exact_count = it == exact.end() ? 0 : it->second;
+        if (exact_count > entries[i].count ||
+            exact_count + entries[i].error < entries[i].count) {
+            Violation("exact count outside [count - error, count]", round,
+                      entries[i].handle, exact_count, &entries[i]);
+        }
+        if (entries[i].error > total / k) {
+            Violation("error above N / K", round, entries[i].handle, exact_count,
+                      &entries[i]);
+        }
+    }
+    for (auto &e : exact) {
+        if (e.second > total / k && monitored.count(e.first) == 0) {
+            Violation("heavy hitter not monitored", round, e.first, e.second, NULL);
+        }
+    }
+}
+
+int
+main()
+{
+    const int32_t k = 64;
+    const int rounds = 200;
+    for (int round = 0; round < rounds; round++) {
+        std::mt19937 gen(round);
+        // 1 to 8 threads, each with its own skew and its own hot handles
+        int32_t sketch_num = 1 + round % 8;
+        std::vector<heavy_hitter_t> sketches(sketch_num);
+        std::map<context_handle_t, uint64_t> exact;
+        uint64_t total = 0;
+        for (int32_t s = 0; s < sketch_num; s++) {
+            sketches[s].init(k);
+            std::map<context_handle_t, uint64_t> thread_exact;
+            double skew = 0.6 + 0.1 * (gen() % 8);
+            int32_t handle_num = 100 + gen() % 5000;
+            std::vector<double> weights;
+            for (int32_t h = 1; h <= handle_num; h++) {
+                weights.push_back(1.0 / std::pow((double)h, skew));
+            }
+            std::discrete_distribution<int32_t> pick(weights.begin(), weights.end());
+            int32_t offset = gen() % 1000;
+            int32_t update_num = 1000 + gen() % 50000;
+            for (int32_t i = 0; i < update_num; i++) {
+                context_handle_t handle = offset + pick(gen);
+                // weights > 1 as in -bb mode
+                uint64_t weight = 1 + (i % 16 == 0 ? gen() % 8 : 0);
+                sketches[s].update(handle, weight);
+                thread_exact[handle] += weight;
+                exact[handle] += weight;
+                total += weight;
+            }
+            std::vector<heavy_hitter_entry_t> entries(k);
+            int32_t size = sketches[s].copy(entries.data());
+            CheckBounds(round, entries.data(), size, thread_exact, sketches[s].total, k);
+        }
+
+        std::vector<heavy_hitter_entry_t> entries(sketch_num * k);
+        std::vector<int32_t> sizes(sketch_num);
+        std::vector<uint64_t> mins(sketch_num);
+        int32_t entry_num = 0;
+        for (int32_t s = 0; s < sketch_num; s++) {
+            sizes[s] = sketches[s].copy(entries.data() + entry_num);
+            mins[s] = sketches[s].min_count();
+            entry_num += sizes[s];
+            sketches[s].free();
+        }
+        int32_t size =
+            heavy_hitter_merge(entries.data(), sizes.data(), mins.data(), sketch_num);
+        CheckBounds(round, entries.data(), size, exact, total, k);
+    }
+    printf("%d rounds, %d violations\n", rounds, violation_num);
+    return violation_num == 0 ? 0 : 1;
+}
@@ -21,14 +21,66 @@
  * - Execution
  *      The application code runs, including the instrumentation code which was inserted
  *      during transformation.
+ *
+ * The inline counting and the sampling check use drreg. The client's CMakeLists.txt in
+ * the DrCCTProf tree (src/clients/drcctlib_instr_statistics_clean_call) must have
+ *      use_DynamoRIO_extension(drcctlib_instr_statistics_clean_call drreg)
+ * next to its drcctlib extension, run.sh adds it.
+ *
+ * Options:
+ * -clean_call
+ *      Count through a clean call to InsCount before every instruction. By default
+ *      the handle lookup and the counter increment are inlined as meta-instructions
+ *      (x86 only, ARM always uses the clean call).
+ * -bb
+ *      Count basic block entries instead of instructions. Every instruction of a block
+ *      runs as often as the block is entered, so one update at the block entry is
+ *      enough; the per-instruction counts are rebuilt in ClientExit.
+ * -heavy_hitter <K>
+ *      Also feed every counted execution into a space-saving sketch of K contexts
+ *      (see drcctlib_heavy_hitter.h). The current top contexts are written to the
+ *      heavy hitter file on every nudge (drconfig -nudge) and at exit, where they are
+ *      checked against the exact counts. Implies -clean_call.
+ * -snapshot <ms>
+ *      Every <ms> milliseconds a DynamoRIO client thread copies the counter tables and
+ *      writes the top list, in the exit report format, to the snapshot file.
+ *      Application threads never wait for the file I/O.
+ * -snapshot_delta
+ *      Write snapshots as "<context handle> <executions since the last snapshot>"
+ *      lines instead.
+ * -sample <N>
+ *      Each thread counts one in N executions of its instructions (of its blocks
+ *      with -bb) on average, at random gaps, see drcctlib_sampling.h. Reported counts are estimates, the count
+ *      times N. Implies -clean_call, only the sampled executions reach the call.
+ * -sample_burst <ON> <OFF>
+ *      Count ON consecutive executions, then skip OFF on average. Counts are scaled by
+ *      (ON + OFF) / ON.
+ * -binary
+ *      Dump the counters, the CCT above them and the module list into
+ *      instr_statistics_clean_call.bin at exit instead of printing backtraces (see
+ *      drcctlib_binary_profile.h). binary_profile_view.py renders the text report
+ *      from it offline.
+ * -roi
+ *      Only count inside the regions the target marks with p0_roi.h, see
+ *      drcctlib_roi.h. Code outside runs without counting instrumentation.
  */
 
 #include <iterator>
 #include <vector>
 #include <map>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include "dr_api.h"
+#include "drreg.h"
 #include "drcctlib.h"
+#include "drcctlib_paged_table.h"
+#include "drcctlib_top_n.h"
+#include "drcctlib_heavy_hitter.h"
+#include "drcctlib_sampling.h"
+#include "drcctlib_binary_profile.h"
+#include "drcctlib_roi.h"
 
 #define DRCCTLIB_PRINTF(_FORMAT, _ARGS...) \
     DRCCTLIB_PRINTF_TEMPLATE("instr_statistics_clean_call", _FORMAT, ##_ARGS) // Make DRCCTLIB_PRINTF alias for DRCCTLIB_PRINTF_TEMPLATE
@@ -41,21 +93,258 @@
 #    define OPND_CREATE_CCT_INT OPND_CREATE_INT32
 #endif
 
+#define MINSERT instrlist_meta_preinsert
+
 #define MAX_CLIENT_CCT_PRINT_DEPTH 10
 #define TOP_REACH_NUM_SHOW 200
 
-uint64_t *gloabl_hndl_call_num;
+paged_table_t<uint64_t> gloabl_hndl_call_num;
+// -bb mode: indexed by the context handle of the first instruction of a block
+typedef struct _bb_count_t {
+    uint64_t entry_num;
+    uint64_t instr_num;
+} bb_count_t;
+paged_table_t<bb_count_t> gloabl_bb_count;
 static file_t gTraceFile;
 
+// -heavy_hitter mode: every thread feeds its own sketch, found through a raw TLS slot
+// and created on its first update. The lock of a sketch is only contended while it is
+// read. Sketches stay on the list after their thread exits, the reader merges them all.
+typedef struct _thread_heavy_hitter_t {
+    heavy_hitter_t sketch;
+    void *lock;
+    struct _thread_heavy_hitter_t *next;
+} thread_heavy_hitter_t;
+
+static thread_heavy_hitter_t *heavy_hitter_list = NULL;
+static int32_t heavy_hitter_num = 0;
+// protects heavy_hitter_list
+static void *heavy_hitter_lock;
+static reg_id_t heavy_hitter_tls_seg;
+static uint heavy_hitter_tls_offs;
+static file_t gHeavyHitterFile;
+
+// -snapshot mode, the tables are private to the snapshot thread
+static file_t gSnapshotFile;
+static paged_table_t<uint64_t> snapshot_call_num;
+static paged_table_t<uint64_t> snapshot_last_call_num;
+
+// -sample and -sample_burst mode
+static sampler_t gSampler;
+
+// -roi mode
+static roi_t gRoi;
+
+static bool op_clean_call = false;
+static bool op_bb = false;
+static int32_t op_heavy_hitter = 0;
+static int32_t op_snapshot = 0;
+static bool op_snapshot_delta = false;
+static int32_t op_sample_period = 1;
+static int32_t op_sample_burst = 1;
+static bool op_binary = false;
+static bool op_roi = false;
+
 using namespace std;
 
+static thread_heavy_hitter_t *
+GetThreadHeavyHitter()
+{
+    thread_heavy_hitter_t **tls = (thread_heavy_hitter_t **)(
+        (byte *)dr_get_dr_segment_base(heavy_hitter_tls_seg) + heavy_hitter_tls_offs);
+    if (*tls == NULL) {
+        thread_heavy_hitter_t *hh =
+            (thread_heavy_hitter_t *)dr_global_alloc(sizeof(thread_heavy_hitter_t));
+        hh->sketch.init(op_heavy_hitter);
+        hh->lock = dr_mutex_create();
+        dr_mutex_lock(heavy_hitter_lock);
+        hh->next = heavy_hitter_list;
+        heavy_hitter_list = hh;
+        heavy_hitter_num++;
+        dr_mutex_unlock(heavy_hitter_lock);
+        *tls = hh;
+    }
+    return *tls;
+}
+
 // Execution
 void
 InsCount(int32_t slot)
 {
+    if (op_sample_period > 1 && !gSampler.sampled()) {
+        return;
+    }
     void *drcontext = dr_get_current_drcontext();
     context_handle_t cur_ctxt_hndl = drcctlib_get_context_handle(drcontext, slot);
-    gloabl_hndl_call_num[cur_ctxt_hndl]++; // cur_ctxt_hndl represents the instruction and call path associated with it?
+    gloabl_hndl_call_num.get(cur_ctxt_hndl)++; // cur_ctxt_hndl represents the instruction and call path associated with it?
+    if (op_heavy_hitter > 0) {
+        thread_heavy_hitter_t *hh = GetThreadHeavyHitter();
+        dr_mutex_lock(hh->lock);
+        hh->sketch.update(cur_ctxt_hndl, 1);
+        dr_mutex_unlock(hh->lock);
+    }
+}
+
+// The instructions of one block in one calling context get consecutive handles, so the
+// handle of slot 0 identifies the block and the block length is all we need to expand
+// its entry count at exit.
+void
+BBCount(int32_t bb_instr_num)
+{
+    if (op_sample_period > 1 && !gSampler.sampled()) {
+        return;
+    }
+    void *drcontext = dr_get_current_drcontext();
+    context_handle_t bb_start_hndl = drcctlib_get_context_handle(drcontext, 0);
+    bb_count_t &bb_count = gloabl_bb_count.get(bb_start_hndl);
+    bb_count.entry_num++;
+    bb_count.instr_num = bb_instr_num;
+    if (op_heavy_hitter > 0) {
+        thread_heavy_hitter_t *hh = GetThreadHeavyHitter();
+        dr_mutex_lock(hh->lock);
+        for (int32_t i = 0; i < bb_instr_num; i++) {
+            hh->sketch.update(bb_start_hndl + i, 1);
+        }
+        dr_mutex_unlock(hh->lock);
+    }
+}
+
+// called from the inlined instrumentation the first time a page is written
+static void
+AllocCallNumPage(context_handle_t handle)
+{
+    gloabl_hndl_call_num.alloc_page(handle >> PAGED_TABLE_PAGE_BITS);
+}
+
+static void
+AllocBBCountPage(context_handle_t handle)
+{
+    gloabl_bb_count.alloc_page(handle >> PAGED_TABLE_PAGE_BITS);
+}
+
+#ifndef ARM_CCTLIB
+// Entry layout of the tables InsertInlineCount can increment: the entry is
+// 8 << entry_shift bytes, the counter is its first quadword and, with has_instr_num,
+// the block length its second. Other types have no layout and do not compile.
+template <typename T> struct inline_count_layout_t;
+
+template <> struct inline_count_layout_t<uint64_t> {
+    static const int32_t entry_shift = 0;
+    static const bool has_instr_num = false;
+};
+
+template <> struct inline_count_layout_t<bb_count_t> {
+    static const int32_t entry_shift = 1;
+    static const bool has_instr_num = true;
+    static_assert(sizeof(bb_count_t) == 2 * sizeof(uint64_t) &&
+                      offsetof(bb_count_t, entry_num) == 0 &&
+                      offsetof(bb_count_t, instr_num) == sizeof(uint64_t),
+                  "bb_count_t no longer matches its inline layout");
+};
+
+// Inline version of InsCount/BBCount: the handle is computed into a register by
+// drcctlib, the page of the table is loaded from the directory and the entry is
+// incremented with a single add. Only a missing page calls out to alloc_page_fn.
+// drreg only spills the registers and the flags when they are live at this point.
+template <typename T>
+static void
+InsertInlineCount(void *drcontext, instrlist_t *bb, instr_t *instr, int32_t slot,
+                  paged_table_t<T> *table, void (*alloc_page_fn)(context_handle_t),
+                  int32_t bb_instr_num)
+{
+    reg_id_t reg_ctxt_hndl, reg_scratch, reg_page;
+    if (drreg_reserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, NULL, &reg_ctxt_hndl) !=
+            DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, NULL, &reg_scratch) !=
+            DRREG_SUCCESS ||
+        drreg_reserve_register(drcontext, bb, instr, NULL, &reg_page) != DRREG_SUCCESS) {
+        DRCCTLIB_EXIT_PROCESS("InsertInlineCount drreg_reserve_register != DRREG_SUCCESS");
+    }
+    drcctlib_get_context_handle_in_reg(drcontext, bb, instr, slot, reg_ctxt_hndl,
+                                       reg_scratch);
+
+    // reg_page = table->pages[hndl >> PAGED_TABLE_PAGE_BITS]
+    instr_t *have_page = INSTR_CREATE_label(drcontext);
+    opnd_t dir_entry = opnd_create_base_disp(reg_page, reg_scratch, sizeof(T *), 0, OPSZ_8);
+    MINSERT(bb, instr,
+            INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(reg_scratch),
+                                opnd_create_reg(reg_ctxt_hndl)));
+    MINSERT(bb, instr,
+            INSTR_CREATE_shr(drcontext, opnd_create_reg(reg_scratch),
+                             OPND_CREATE_INT8(PAGED_TABLE_PAGE_BITS)));
+    MINSERT(bb, instr,
+            INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(reg_page),
+                                 OPND_CREATE_INTPTR((ptr_int_t)table->pages)));
+    MINSERT(bb, instr, INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(reg_page), dir_entry));
+    MINSERT(bb, instr,
+            INSTR_CREATE_test(drcontext, opnd_create_reg(reg_page),
+                              opnd_create_reg(reg_page)));
+    MINSERT(bb, instr, INSTR_CREATE_jcc(drcontext, OP_jnz, opnd_create_instr(have_page)));
+    dr_insert_clean_call(drcontext, bb, instr, (void *)alloc_page_fn, false, 1,
+                         opnd_create_reg(reg_ctxt_hndl));
+    MINSERT(bb, instr,
+            INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(reg_page),
+                                 OPND_CREATE_INTPTR((ptr_int_t)table->pages)));
+    MINSERT(bb, instr, INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(reg_page), dir_entry));
+    MINSERT(bb, instr, have_page);
+
+    // reg_ctxt_hndl = offset of the entry in 8 byte units
+    typedef inline_count_layout_t<T> layout;
+    MINSERT(bb, instr,
+            INSTR_CREATE_and(drcontext, opnd_create_reg(reg_ctxt_hndl),
+                             OPND_CREATE_INT32(PAGED_TABLE_PAGE_MASK)));
+    if (layout::entry_shift > 0) {
+        MINSERT(bb, instr,
+                INSTR_CREATE_shl(drcontext, opnd_create_reg(reg_ctxt_hndl),
+                                 OPND_CREATE_INT8(layout::entry_shift)));
+    }
+    if (layout::has_instr_num) {
+        // bb_count_t::instr_num
+        MINSERT(bb, instr,
+                INSTR_CREATE_mov_st(drcontext,
+                                    opnd_create_base_disp(reg_page, reg_ctxt_hndl,
+                                                          sizeof(uint64_t),
+                                                          sizeof(uint64_t), OPSZ_8),
+                                    OPND_CREATE_INT32(bb_instr_num)));
+    }
+    MINSERT(bb, instr,
+            INSTR_CREATE_add(drcontext,
+                             opnd_create_base_disp(reg_page, reg_ctxt_hndl,
+                                                   sizeof(uint64_t), 0, OPSZ_8),
+                             OPND_CREATE_INT8(1)));
+
+    if (drreg_unreserve_register(drcontext, bb, instr, reg_page) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, instr, reg_scratch) != DRREG_SUCCESS ||
+        drreg_unreserve_register(drcontext, bb, instr, reg_ctxt_hndl) !=
+            DRREG_SUCCESS ||
+        drreg_unreserve_aflags(drcontext, bb, instr) != DRREG_SUCCESS) {
+        DRCCTLIB_EXIT_PROCESS("InsertInlineCount drreg_unreserve_register != DRREG_SUCCESS");
+    }
+}
+#endif
+
+static void
+InsertCleanCall(void *drcontext, instrlist_t *bb, instr_t *instr, void *callee, int32_t arg)
+{
+    if (op_sample_period > 1) {
+        gSampler.insert_clean_call(drcontext, bb, instr, callee, OPND_CREATE_CCT_INT(arg));
+    } else {
+        dr_insert_clean_call(drcontext, bb, instr, callee, false, 1, OPND_CREATE_CCT_INT(arg));
+    }
+}
+
+// -roi mode
+static bool
+RoiFilter(instr_t *instr)
+{
+    return gRoi.filter(instr);
+}
+
+static void
+RoiMarker(int32_t type, app_pc next_pc)
+{
+    gRoi.update(type, next_pc);
 }
 
 // Transformation
@@ -67,30 +356,328 @@ InsTransEventCallback(void *drcontext, instr_instrument_msg_t *instrument_msg)
     instr_t *instr = instrument_msg->instr;
     int32_t slot = instrument_msg->slot;
 
-    dr_insert_clean_call(drcontext, bb, instr, (void *)InsCount, false, 1, OPND_CREATE_CCT_INT(slot));
+    int32_t roi_marker = gRoi.marker(instr);
+    if (roi_marker != ROI_MARKER_NONE) {
+        gRoi.insert_marker_call(drcontext, bb, instr, roi_marker, (void *)RoiMarker);
+        return;
+    }
+    if (!gRoi.active()) {
+        return;
+    }
+
+    if (op_bb) {
+        if (slot != 0) {
+            return;
+        }
+        int32_t bb_instr_num = 0;
+        for (instr_t *i = instr; i != NULL; i = instr_get_next_app(i)) {
+            bb_instr_num++;
+        }
+#ifndef ARM_CCTLIB
+        if (!op_clean_call) {
+            InsertInlineCount(drcontext, bb, instr, 0, &gloabl_bb_count, AllocBBCountPage,
+                              bb_instr_num);
+            return;
+        }
+#endif
+        InsertCleanCall(drcontext, bb, instr, (void *)BBCount, bb_instr_num);
+        return;
+    }
+
+#ifndef ARM_CCTLIB
+    if (!op_clean_call) {
+        InsertInlineCount(drcontext, bb, instr, slot, &gloabl_hndl_call_num,
+                          AllocCallNumPage, 0);
+        return;
+    }
+#endif
+    InsertCleanCall(drcontext, bb, instr, (void *)InsCount, slot);
 }
 
 static inline void
 InitGlobalBuff()
 {
-    gloabl_hndl_call_num = (uint64_t *)dr_raw_mem_alloc(
-        CONTEXT_HANDLE_MAX * sizeof(uint64_t), DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
-    if (gloabl_hndl_call_num == NULL) {
+    if (!gloabl_hndl_call_num.init(true)) {
         DRCCTLIB_EXIT_PROCESS(
             "init_global_buff error: dr_raw_mem_alloc fail gloabl_hndl_call_num");
     }
+    if (op_bb && !gloabl_bb_count.init(true)) {
+        DRCCTLIB_EXIT_PROCESS(
+            "init_global_buff error: dr_raw_mem_alloc fail gloabl_bb_count");
+    }
 }
 
 static inline void
 FreeGlobalBuff()
 {
-    dr_raw_mem_free(gloabl_hndl_call_num, CONTEXT_HANDLE_MAX * sizeof(uint64_t));
+    gloabl_hndl_call_num.free();
+    if (op_bb) {
+        gloabl_bb_count.free();
+    }
+}
+
+// -bb mode: give every instruction of a block the entry count of its block
+static void
+ExpandBBCount(context_handle_t max_ctxt_hndl)
+{
+    paged_table_for_each(gloabl_bb_count, max_ctxt_hndl,
+                         [](context_handle_t i, bb_count_t &bb_count) {
+                             if (bb_count.entry_num == 0) {
+                                 return;
+                             }
+                             for (uint64_t j = 0; j < bb_count.instr_num; j++) {
+                                 gloabl_hndl_call_num.get(i + j) += bb_count.entry_num;
+                             }
+                         });
+}
+
+static void
+PrintTopList(file_t file, paged_table_t<uint64_t> &call_num_table,
+             context_handle_t max_ctxt_hndl)
+{
+    top_n_t top_list;
+    top_list.init(TOP_REACH_NUM_SHOW);
+
+    // only the pages of contexts that executed are scanned
+    paged_table_for_each(call_num_table, max_ctxt_hndl,
+                         [&top_list](context_handle_t i, uint64_t &call_num) {
+                             if (call_num > top_list.threshold()) {
+                                 top_list.push(i, call_num);
+                             }
+                         });
+    top_list.sort();
+
+    // print output
+    if (op_sample_period > 1) {
+        dr_fprintf(file, "SAMPLING %d/%d, EXECUTION TIMES ARE ESTIMATES\n\n",
+                   op_sample_burst, op_sample_period);
+    }
+    if (op_roi) {
+        dr_fprintf(file, "REGION OF INTEREST ONLY\n\n");
+    }
+    output_format_t *output_list = top_list.list;
+    for (int32_t i = 0; i < top_list.size; i++) {
+        dr_fprintf(file, "NO. %d PC ", i + 1);
+        drcctlib_print_backtrace_first_item(file, output_list[i].handle, true, false);
+        dr_fprintf(file, "=>EXECUTION TIMES\n%lld\n=>BACKTRACE\n",
+                   gSampler.estimate(output_list[i].count));
+        drcctlib_print_backtrace(file, output_list[i].handle, true, true, -1);
+        dr_fprintf(file, "\n\n\n");
+    }
+    top_list.free();
+}
+
+// -binary mode: every executed context with its estimated execution count
+static void
+WriteBinaryProfile(context_handle_t max_ctxt_hndl)
+{
+    static const char *const metric_names[] = { "EXECUTION TIMES" };
+    char name[MAXIMUM_FILEPATH] = "";
+    DRCCTLIB_INIT_LOG_FILE_NAME(name, "instr_statistics_clean_call", "bin");
+    if (!binary_profile_write(name, gloabl_hndl_call_num, max_ctxt_hndl, 1, metric_names,
+                              op_sample_burst, op_sample_period,
+                              [](uint64_t &call_num, uint64_t *metrics) {
+                                  metrics[0] = gSampler.estimate(call_num);
+                                  return call_num != 0;
+                              })) {
+        DRCCTLIB_PRINTF("ERROR: unable to write %s", name);
+    }
+}
+
+// Copies the live counts into snapshot_call_num. Counters are only read, application
+// threads keep counting while this runs.
+static void
+TakeSnapshot(context_handle_t max_ctxt_hndl)
+{
+    snapshot_call_num.clear();
+    if (op_bb) {
+        paged_table_for_each(gloabl_bb_count, max_ctxt_hndl,
+                             [](context_handle_t i, bb_count_t &bb_count) {
+                                 uint64_t entry_num = bb_count.entry_num;
+                                 if (entry_num == 0) {
+                                     return;
+                                 }
+                                 for (uint64_t j = 0; j < bb_count.instr_num; j++) {
+                                     snapshot_call_num.get(i + j) += entry_num;
+                                 }
+                             });
+    } else {
+        paged_table_for_each(gloabl_hndl_call_num, max_ctxt_hndl,
+                             [](context_handle_t i, uint64_t &call_num) {
+                                 uint64_t value = call_num;
+                                 if (value != 0) {
+                                     snapshot_call_num.get(i) = value;
+                                 }
+                             });
+    }
+}
+
+static void
+SnapshotThread(void *arg)
+{
+    uint64_t start_time = dr_get_milliseconds();
+    for (int32_t snapshot_idx = 1;; snapshot_idx++) {
+        dr_sleep(op_snapshot);
+        // DR must not suspend this thread at exit with a snapshot half written, the
+        // exit waits until the thread is suspendable again
+        dr_client_thread_set_suspendable(false);
+        context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num();
+        TakeSnapshot(max_ctxt_hndl);
+        dr_fprintf(gSnapshotFile, "SNAPSHOT %d TIME %llu ms%s\n", snapshot_idx,
+                   dr_get_milliseconds() - start_time, op_snapshot_delta ? " DELTA" : "");
+        if (!op_snapshot_delta) {
+            PrintTopList(gSnapshotFile, snapshot_call_num, max_ctxt_hndl);
+        } else {
+            paged_table_for_each(snapshot_call_num, max_ctxt_hndl,
+                                 [](context_handle_t i, uint64_t &call_num) {
+                                     uint64_t &last = snapshot_last_call_num.get(i);
+                                     if (call_num != last) {
+                                         dr_fprintf(gSnapshotFile, "%d %llu\n", i,
+                                                    gSampler.estimate(call_num - last));
+                                         last = call_num;
+                                     }
+                                 });
+        }
+        dr_fprintf(gSnapshotFile, "END SNAPSHOT %d\n", snapshot_idx);
+        dr_flush_file(gSnapshotFile);
+        dr_client_thread_set_suspendable(true);
+    }
+}
+
+// Merges the thread sketches and prints the K contexts with the largest merged counts.
+// Each sketch is only locked while its K counters are copied. With exact == true the
+// counts are compared with gloabl_hndl_call_num, which is only complete at exit. Its
+// increments race between threads, so on a multithreaded target it can undercount and
+// the violations are only reported.
+static void
+PrintHeavyHitters(bool exact)
+{
+    dr_mutex_lock(heavy_hitter_lock);
+    int32_t sketch_num = heavy_hitter_num;
+    size_t entries_size = ((size_t)sketch_num * op_heavy_hitter + 1) *
+        sizeof(heavy_hitter_entry_t);
+    heavy_hitter_entry_t *entries = (heavy_hitter_entry_t *)dr_global_alloc(entries_size);
+    int32_t *sizes = (int32_t *)dr_global_alloc((sketch_num + 1) * sizeof(int32_t));
+    uint64_t *mins = (uint64_t *)dr_global_alloc((sketch_num + 1) * sizeof(uint64_t));
+    uint64_t total = 0;
+    int32_t entry_num = 0;
+    int32_t s = 0;
+    for (thread_heavy_hitter_t *hh = heavy_hitter_list; hh != NULL; hh = hh->next, s++) {
+        dr_mutex_lock(hh->lock);
+        sizes[s] = hh->sketch.copy(entries + entry_num);
+        mins[s] = hh->sketch.min_count();
+        total += hh->sketch.total;
+        dr_mutex_unlock(hh->lock);
+        entry_num += sizes[s];
+    }
+    dr_mutex_unlock(heavy_hitter_lock);
+    // N / K of the merged stream
+    uint64_t error_bound = total / op_heavy_hitter;
+
+    int32_t size = heavy_hitter_merge(entries, sizes, mins, sketch_num);
+    std::sort(entries, entries + size,
+              [](const heavy_hitter_entry_t &a, const heavy_hitter_entry_t &b) {
+                  return a.count > b.count;
+              });
+    size = std::min(size, op_heavy_hitter);
+    // the bounds hold for the sampled counts, the output scales everything
+    dr_fprintf(gHeavyHitterFile,
+               "HEAVY HITTERS : %llu executions, error bound %llu\n",
+               gSampler.estimate(total), gSampler.estimate(error_bound));
+    int32_t bound_violation = 0;
+    for (int32_t i = 0; i < size; i++) {
+        dr_fprintf(gHeavyHitterFile, "NO. %d PC ", i + 1);
+        drcctlib_print_backtrace_first_item(gHeavyHitterFile, entries[i].handle, true,
+                                            false);
+        dr_fprintf(gHeavyHitterFile, "=>EXECUTION TIMES\n%llu (-%llu)\n",
+                   gSampler.estimate(entries[i].count), gSampler.estimate(entries[i].error));
+        if (exact) {
+            uint64_t *call_num = gloabl_hndl_call_num.find(entries[i].handle);
+            uint64_t exact_count = call_num == NULL ? 0 : *call_num;
+            dr_fprintf(gHeavyHitterFile, "=>EXACT\n%llu\n", gSampler.estimate(exact_count));
+            if (exact_count > entries[i].count ||
+                exact_count < entries[i].count - entries[i].error ||
+                entries[i].error > error_bound) {
+                bound_violation++;
+            }
+        }
+        dr_fprintf(gHeavyHitterFile, "=>BACKTRACE\n");
+        drcctlib_print_backtrace(gHeavyHitterFile, entries[i].handle, true, true, -1);
+        dr_fprintf(gHeavyHitterFile, "\n\n\n");
+    }
+    if (exact) {
+        dr_fprintf(gHeavyHitterFile, "HEAVY HITTER BOUND VIOLATIONS : %d\n",
+                   bound_violation);
+    }
+    dr_global_free(entries, entries_size);
+    dr_global_free(sizes, (sketch_num + 1) * sizeof(int32_t));
+    dr_global_free(mins, (sketch_num + 1) * sizeof(uint64_t));
+}
+
+static void
+ClientNudge(void *drcontext, uint64_t argument)
+{
+    PrintHeavyHitters(false);
+}
+
+static void
+ClientParseOptions(int argc, const char *argv[])
+{
+    // argv[0] is the client library path
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-clean_call") == 0) {
+            op_clean_call = true;
+        } else if (strcmp(argv[i], "-bb") == 0) {
+            op_bb = true;
+        } else if (strcmp(argv[i], "-heavy_hitter") == 0 && i + 1 < argc) {
+            op_heavy_hitter = atoi(argv[++i]);
+            if (op_heavy_hitter <= 0) {
+                DRCCTLIB_EXIT_PROCESS("-heavy_hitter needs a positive size");
+            }
+            op_clean_call = true;
+        } else if (strcmp(argv[i], "-snapshot") == 0 && i + 1 < argc) {
+            op_snapshot = atoi(argv[++i]);
+            if (op_snapshot <= 0) {
+                DRCCTLIB_EXIT_PROCESS("-snapshot needs a positive period in ms");
+            }
+        } else if (strcmp(argv[i], "-snapshot_delta") == 0) {
+            op_snapshot_delta = true;
+        } else if (strcmp(argv[i], "-binary") == 0) {
+            op_binary = true;
+        } else if (strcmp(argv[i], "-roi") == 0) {
+            op_roi = true;
+        } else if (strcmp(argv[i], "-sample") == 0 && i + 1 < argc) {
+            op_sample_period = atoi(argv[++i]);
+            op_sample_burst = 1;
+            if (op_sample_period <= 0) {
+                DRCCTLIB_EXIT_PROCESS("-sample needs a positive period");
+            }
+            op_clean_call = true;
+        } else if (strcmp(argv[i], "-sample_burst") == 0 && i + 2 < argc) {
+            op_sample_burst = atoi(argv[++i]);
+            int32_t off = atoi(argv[++i]);
+            if (op_sample_burst <= 0 || off < 0) {
+                DRCCTLIB_EXIT_PROCESS("-sample_burst needs a positive ON and OFF >= 0");
+            }
+            op_sample_period = op_sample_burst + off;
+            op_clean_call = true;
+        } else {
+            DRCCTLIB_EXIT_PROCESS("unknown client option %s", argv[i]);
+        }
+    }
 }
 
 // register dynamoRIO extensions
 static void
 ClientInit(int argc, const char *argv[])
 {
+    ClientParseOptions(argc, argv);
+
+    drreg_options_t ops = { sizeof(ops), 3 /*max slots needed*/, false };
+    if (drreg_init(&ops) != DRREG_SUCCESS) {
+        DRCCTLIB_EXIT_PROCESS("ERROR: instr_statistics_clean_call unable to init drreg");
+    }
+
     char name[MAXIMUM_FILEPATH] = "";
     DRCCTLIB_INIT_LOG_FILE_NAME(
         name, "instr_statistics_clean_call", "out");
@@ -100,83 +687,74 @@ ClientInit(int argc, const char *argv[])
     DR_ASSERT(gTraceFile != INVALID_FILE);
 
     InitGlobalBuff();
-    // InsTransEventCallback runs on each instruction in the test program
-    drcctlib_init(DRCCTLIB_FILTER_ALL_INSTR, INVALID_FILE, InsTransEventCallback, false);
+    gRoi.init(op_roi);
+    // with period 1 estimate() is the identity
+    if (!gSampler.init(op_sample_period, op_sample_burst)) {
+        DRCCTLIB_EXIT_PROCESS("ERROR: instr_statistics_clean_call unable to allocate raw TLS");
+    }
+    if (op_heavy_hitter > 0) {
+        DRCCTLIB_INIT_LOG_FILE_NAME(name, "instr_statistics_clean_call_heavy_hitter",
+                                    "out");
+        gHeavyHitterFile = dr_open_file(name, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+        DR_ASSERT(gHeavyHitterFile != INVALID_FILE);
+        heavy_hitter_lock = dr_mutex_create();
+        if (!dr_raw_tls_calloc(&heavy_hitter_tls_seg, &heavy_hitter_tls_offs, 1, 0)) {
+            DRCCTLIB_EXIT_PROCESS("ERROR: instr_statistics_clean_call unable to allocate raw TLS");
+        }
+    }
+    if (op_snapshot > 0) {
+        DRCCTLIB_INIT_LOG_FILE_NAME(name, "instr_statistics_clean_call_snapshot", "out");
+        gSnapshotFile = dr_open_file(name, DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+        DR_ASSERT(gSnapshotFile != INVALID_FILE);
+        if (!snapshot_call_num.init(false) || !snapshot_last_call_num.init(false)) {
+            DRCCTLIB_EXIT_PROCESS("ERROR: snapshot tables dr_raw_mem_alloc fail");
+        }
+        if (!dr_create_client_thread(SnapshotThread, NULL)) {
+            DRCCTLIB_EXIT_PROCESS("ERROR: unable to create the snapshot thread");
+        }
+    }
+    // InsTransEventCallback runs on each instruction in the test program, with -roi
+    // only inside a region and on the markers
+    drcctlib_init(RoiFilter, INVALID_FILE, InsTransEventCallback, false);
 }
 
-typedef struct _output_format_t {
-    context_handle_t handle;
-    uint64_t count;
-} output_format_t;
-
 // dynamoRIO calls this
 static void
 ClientExit(void)
 {
-    output_format_t *output_list =
-        (output_format_t *)dr_global_alloc(TOP_REACH_NUM_SHOW * sizeof(output_format_t));
-    for (int32_t i = 0; i < TOP_REACH_NUM_SHOW; i++) {
-        output_list[i].handle = 0; // this is index of gloabl_hndl_call_num
-        output_list[i].count = 0; // this is value of gloabl_hndl_call_num[i]
-    }
     context_handle_t max_ctxt_hndl = drcctlib_get_global_context_handle_num(); // get number of contexts in gloabl_hndl_call_num
     // i think a context is an instruction plus its call path
-
-    for (context_handle_t i = 0; i < max_ctxt_hndl; i++) {
-        if (gloabl_hndl_call_num[i] <= 0) {
-            continue;
-        }
-        if (gloabl_hndl_call_num[i] > output_list[0].count) { // output_list initialized to zeroes
-            uint64_t min_count = gloabl_hndl_call_num[i];
-            int32_t min_idx = 0;
-            // i is index for gloabl_hndl_call_num, j is index for output_list
-            for (int32_t j = 1; j < TOP_REACH_NUM_SHOW; j++) { // TOP_REACH_NUM_SHOW is size of output_list, output_list[0] has least called instr
-                if (output_list[j].count < min_count) {
-                    min_count = output_list[j].count;
-                    min_idx = j;
-                }
-            }
-
-            // if gloabl_hndl_call_num > output_list[0].count, iterate all output_list.count and find smallest output_list.count
-            // overwrite output_list[0] with smallest count
-            output_list[0].count = min_count;
-            output_list[0].handle = output_list[min_idx].handle;
-            // min_idx was just moved to 0, overwrite min_idx with gloabl_hndl_call_num[i]
-            // i think this is done because there is limited amount of space in output_list
-            output_list[min_idx].count = gloabl_hndl_call_num[i];
-            output_list[min_idx].handle = i;
-        }
+    if (op_bb) {
+        ExpandBBCount(max_ctxt_hndl);
     }
-
-    // sort
-    output_format_t temp;
-    for (int32_t i = 0; i < TOP_REACH_NUM_SHOW; i++) {
-        for (int32_t j = i; j < TOP_REACH_NUM_SHOW; j++) {
-            if (output_list[i].count < output_list[j].count) {
-                temp = output_list[i];
-                output_list[i] = output_list[j];
-                output_list[j] = temp;
-            }
-        }
+    if (op_binary) {
+        WriteBinaryProfile(max_ctxt_hndl);
+    } else {
+        PrintTopList(gTraceFile, gloabl_hndl_call_num, max_ctxt_hndl);
     }
-
-    // print output
-    for (int32_t i = 0; i < TOP_REACH_NUM_SHOW; i++) {
-        if (output_list[i].handle == 0) {
-            break;
+    if (op_heavy_hitter > 0) {
+        PrintHeavyHitters(true);
+        while (heavy_hitter_list != NULL) {
+            thread_heavy_hitter_t *hh = heavy_hitter_list;
+            heavy_hitter_list = hh->next;
+            hh->sketch.free();
+            dr_mutex_destroy(hh->lock);
+            dr_global_free(hh, sizeof(thread_heavy_hitter_t));
         }
-        dr_fprintf(gTraceFile, "NO. %d PC ", i + 1);
-        drcctlib_print_backtrace_first_item(gTraceFile, output_list[i].handle, true, false);
-        dr_fprintf(gTraceFile, "=>EXECUTION TIMES\n%lld\n=>BACKTRACE\n",
-                   output_list[i].count);
-        drcctlib_print_backtrace(gTraceFile, output_list[i].handle, true, true, -1);
-        dr_fprintf(gTraceFile, "\n\n\n");
-        
-        
-    }
-    dr_global_free(output_list, TOP_REACH_NUM_SHOW * sizeof(output_format_t));
+        dr_raw_tls_cfree(heavy_hitter_tls_offs, 1);
+        dr_mutex_destroy(heavy_hitter_lock);
+        dr_close_file(gHeavyHitterFile);
+    }
+    if (op_snapshot > 0) {
+        // the snapshot thread is suspended between two snapshots by now, so the file
+        // ends with a complete one. Its tables are left to the process exit.
+        dr_close_file(gSnapshotFile);
+    }
     FreeGlobalBuff();
+    gSampler.free();
     drcctlib_exit();
+    gRoi.free();
+    drreg_exit();
 
     dr_close_file(gTraceFile);
 }
@@ -193,6 +771,7 @@ dr_client_main(client_id_t id, int argc, const char *argv[])
 
     ClientInit(argc, argv);
     dr_register_exit_event(ClientExit);
+    dr_register_nudge_event(ClientNudge, id);
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,62 @@
+# Reader for instr_analysis.memtrace, the -memtrace output of drcctlib_instr_analysis.
+# The file is a sequence of chunks, one per flushed thread buffer: <tid, record count>
+# followed by that many <context handle, size, is_write, address> records.
+#
+#   python3 memtrace_view.py instr_analysis.memtrace              per-context summary
+#   python3 memtrace_view.py instr_analysis.memtrace -n 50        top 50 contexts
+#   python3 memtrace_view.py instr_analysis.memtrace dump         one line per access
+
+import struct, sys
+
+CHUNK = struct.Struct( "<iI" )
+RECORD = struct.Struct( "<iHHQ" )
+LINE_SHIFT = 6
+SEPARATOR = "=" * 80
+
+def records( data ):
+	offset = 0
+	while offset + CHUNK.size <= len( data ):
+		tid, ref_num = CHUNK.unpack_from( data, offset )
+		offset += CHUNK.size
+		for i in range( ref_num ):
+			if offset + RECORD.size > len( data ):
+				return
+			yield ( tid, ) + RECORD.unpack_from( data, offset )
+			offset += RECORD.size
+
+def dump( data ):
+	for tid, ctxt, size, is_write, addr in records( data ):
+		print( "tid(%d) ctxt(%d) %s %x %d" % ( tid, ctxt, "W" if is_write else "R", addr, size ) )
+
+def summary( data, top ):
+	stats = { }
+	total = 0
+	for tid, ctxt, size, is_write, addr in records( data ):
+		s = stats.get( ctxt )
+		if s is None:
+			s = stats[ ctxt ] = [ 0, 0, 0, set( ) ]
+		s[ 1 if is_write else 0 ] += 1
+		s[ 2 ] += size
+		s[ 3 ].add( addr >> LINE_SHIFT )
+		total += 1
+	print( "TOTAL ACCESSES: %d CONTEXTS: %d" % ( total, len( stats ) ) )
+	ranked = sorted( stats.items( ), key=lambda kv: kv[ 1 ][ 0 ] + kv[ 1 ][ 1 ], reverse=True )
+	for rank, ( ctxt, s ) in enumerate( ranked[ : top ] ):
+		print( SEPARATOR )
+		print( "NO. %d ctxt(%d) LOADS: %d STORES: %d BYTES: %d LINES: %d" % ( rank + 1, ctxt,
+			s[ 0 ], s[ 1 ], s[ 2 ], len( s[ 3 ] ) ) )
+
+def main( ):
+	if len( sys.argv ) < 2:
+		sys.exit( "usage: memtrace_view.py <trace> [dump] [-n N]" )
+	data = open( sys.argv[ 1 ], "rb" ).read( )
+	args = sys.argv[ 2: ]
+	top = 20
+	if "-n" in args:
+		top = int( args[ args.index( "-n" ) + 1 ] )
+	if "dump" in args:
+		dump( data )
+	else:
+		summary( data, top )
+
+main( )
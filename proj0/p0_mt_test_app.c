@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// same work per thread as p0_test_app, run by argv[1] threads
+static void sub_fun(int *exe_num) {
+    for(int i = 0; i < 100; i++){
+        (*exe_num) ++;
+    }
+    return;
+}
+static void *fun(void *arg) {
+    int exe_num = 0;
+    for(int i = 0; i < 30000; i++){
+        sub_fun(&exe_num);
+    }
+    return NULL;
+}
+int main(int argc, char *argv[]){
+    int thread_num = argc > 1 ? atoi(argv[1]) : 1;
+    pthread_t *threads = malloc(thread_num * sizeof(pthread_t));
+    for(int i = 0; i < thread_num; i++){
+        pthread_create(&threads[i], NULL, fun, NULL);
+    }
+    for(int i = 0; i < thread_num; i++){
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return 0;
+}
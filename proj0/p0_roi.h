@@ -0,0 +1,33 @@
+/* p0_roi.h
+ *
+ * Region-of-interest markers for targets of the proj0 clients, header only and without
+ * DynamoRIO headers. Run with -roi, a client only counts between P0_ROI_START() and
+ * P0_ROI_STOP(), the code outside runs without counting instrumentation. Regions nest
+ * and may be entered by several threads, counting is on while any region is open.
+ *
+ * The markers are xchg instructions of a register with itself, which compilers do not
+ * emit. Natively and without -roi they are nops.
+ *
+ *      #include "p0_roi.h"
+ *      ...
+ *      P0_ROI_START();
+ *      hot_loop();
+ *      P0_ROI_STOP();
+ */
+
+#ifndef _P0_ROI_H_
+#define _P0_ROI_H_
+
+#if defined(__x86_64__)
+#    define P0_ROI_START() __asm__ __volatile__("xchg %%rbx, %%rbx" ::: "memory")
+#    define P0_ROI_STOP() __asm__ __volatile__("xchg %%rcx, %%rcx" ::: "memory")
+#elif defined(__i386__)
+#    define P0_ROI_START() __asm__ __volatile__("xchg %%ebx, %%ebx" ::: "memory")
+#    define P0_ROI_STOP() __asm__ __volatile__("xchg %%ecx, %%ecx" ::: "memory")
+#else
+// the ARM clients do not look for markers
+#    define P0_ROI_START() do { } while (0)
+#    define P0_ROI_STOP() do { } while (0)
+#endif
+
+#endif // _P0_ROI_H_
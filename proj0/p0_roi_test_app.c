@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "p0_roi.h"
+
+// p0_test_app's work inside a region of interest, after a startup phase that runs
+// argv[1] times as long and is not of interest
+static unsigned long exe_num = 0;
+void startup_fun() {
+    for(int i = 0; i < 100; i++){
+        exe_num += i;
+    }
+}
+void sub_fun() {
+    for(int i = 0; i < 100; i++){
+        exe_num ++;
+    }
+    return;
+}
+void fun() {
+    for(int i = 0; i < 10000; i++){
+        sub_fun();
+    }
+}
+int main(int argc, char *argv[]){
+    int startup_scale = argc > 1 ? atoi(argv[1]) : 20;
+    for(int i = 0; i < startup_scale * 30000; i++){
+        startup_fun();
+    }
+    P0_ROI_START();
+    fun();
+    for(int i = 0; i < 20000; i++){
+        sub_fun();
+    }
+    P0_ROI_STOP();
+    printf("%lu\n", exe_num);
+    return 0;
+}
@@ -5,6 +5,13 @@ git clone --recurse https://github.com/Xuhpclab/DrCCTProf.git
 mkdir DrCCTProf/src/clients/drcctlib_instr_analysis
 vim DrCCTProf/src/clients/drcctlib_instr_analysis/CMakeLists.txt
 vim DrCCTProf/src/clients/drcctlib_instr_analysis/drcctlib_instr_analysis.cpp
+cp drcctlib_paged_table.h drcctlib_top_n.h drcctlib_heavy_hitter.h drcctlib_sampling.h drcctlib_binary_profile.h \
+    drcctlib_cache_sim.h drcctlib_reuse_distance.h drcctlib_branch_predictor.h drcctlib_roi.h DrCCTProf/src/clients/
+
+# instr_statistics_clean_call needs drreg for its inline counting and sampling
+cmake_clean_call=DrCCTProf/src/clients/drcctlib_instr_statistics_clean_call/CMakeLists.txt
+grep -q "drcctlib_instr_statistics_clean_call drreg" $cmake_clean_call || \
+    sed -i '/use_DynamoRIO_extension(drcctlib_instr_statistics_clean_call drcctlib)/a use_DynamoRIO_extension(drcctlib_instr_statistics_clean_call drreg)' $cmake_clean_call
 
 ./DrCCTProf/build.sh # or ./DrCCTProf/scripts/build_tool/remake.sh
 
@@ -12,4 +19,68 @@ vim p0_test_app.c
 gcc -g p0_test_app.c -o p0_test_app
 
 export drrun=/afs/unity.ncsu.edu/users/l/lbadams2/csc512/proj0/DrCCTProf/build/bin64/drrun
-$drrun -t drcctlib_instr_analysis -- p0_test_app
\ No newline at end of file
+$drrun -t drcctlib_instr_analysis -- p0_test_app
+# instr_statistics_clean_call: inline counting (default) or the clean call fallback
+$drrun -t drcctlib_instr_statistics_clean_call -- p0_test_app
+$drrun -t drcctlib_instr_statistics_clean_call -clean_call -- p0_test_app
+
+# block granularity counting
+$drrun -t drcctlib_instr_statistics_clean_call -bb -- p0_test_app
+$drrun -t drcctlib_instr_analysis -bb -- p0_test_app
+
+# multithreaded target, the same work per thread
+gcc -g p0_mt_test_app.c -o p0_mt_test_app -lpthread
+$drrun -t drcctlib_instr_analysis -- p0_mt_test_app 8
+
+# live top contexts: write the heavy hitter sketch of a running process
+$drrun -t drcctlib_instr_statistics_clean_call -heavy_hitter 200 -- p0_test_app &
+./DrCCTProf/build/bin64/drconfig -nudge p0_test_app 0 0
+wait
+
+# streaming snapshots every 500 ms, full reports or per-context deltas
+$drrun -t drcctlib_instr_statistics_clean_call -snapshot 500 -- p0_mt_test_app 8
+$drrun -t drcctlib_instr_analysis -snapshot 500 -snapshot_delta -- p0_mt_test_app 8
+
+# sampling: estimate accuracy against the exact run and overhead per sampling rate
+$drrun -t drcctlib_instr_statistics_clean_call -sample 100 -- p0_test_app
+$drrun -t drcctlib_instr_analysis -sample_burst 100 900 -- p0_test_app
+python3 sample_check.py $drrun ./p0_test_app
+python3 sample_check.py $drrun ./p0_mt_test_app 8
+
+# binary exit dump, rendered offline
+# the file is named by DRCCTLIB_INIT_LOG_FILE_NAME, take the newest one
+$drrun -t drcctlib_instr_analysis -binary -- p0_test_app
+bin=$(ls -t instr_analysis*.bin | head -n 1)
+python3 binary_profile_view.py "$bin"
+python3 binary_profile_view.py "$bin" folded -m 0 > load.folded
+
+# multi-metric profile for the DrCCTProf viewers
+$drrun -t drcctlib_instr_analysis -drcctprof -- p0_test_app
+
+# memory-address trace of every load and store, summarized offline
+$drrun -t drcctlib_instr_analysis -memtrace -- p0_test_app
+python3 memtrace_view.py "$(ls -t instr_analysis*.memtrace | head -n 1)" -n 20
+
+# simulated L1/LLC misses per calling context
+$drrun -t drcctlib_instr_analysis -cache -- p0_test_app
+$drrun -t drcctlib_instr_analysis -cache -cache_l1 48 12 -cache_llc 1024 16 -cache_line 64 -- p0_test_app
+
+# reuse distance histograms per context, also as .drcctprof metrics
+$drrun -t drcctlib_instr_analysis -reuse -- p0_test_app
+$drrun -t drcctlib_instr_analysis -reuse -drcctprof -cache_line 128 -- p0_test_app
+
+# branch directions and simulated mispredictions per context
+$drrun -t drcctlib_instr_analysis -branch -- p0_test_app
+
+# region of interest: only the work between the p0_roi.h markers is counted
+gcc -g -O1 p0_roi_test_app.c -o p0_roi_test_app
+$drrun -t drcctlib_instr_statistics_clean_call -roi -- p0_roi_test_app
+$drrun -t drcctlib_instr_analysis -roi -- p0_roi_test_app
+
+# error bounds of the heavy hitter sketch and its per-thread merge against exact counts
+g++ -O2 -std=c++11 -Iheavy_hitter_check heavy_hitter_check/heavy_hitter_check.cpp -o heavy_hitter_check/heavy_hitter_check
+./heavy_hitter_check/heavy_hitter_check
+
+# per-point sampling estimates on p0_test_app's loop shape, without DynamoRIO
+g++ -O2 -std=c++11 -Isampling_check sampling_check/sampling_check.cpp -o sampling_check/sampling_check
+./sampling_check/sampling_check
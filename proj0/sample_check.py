@@ -0,0 +1,117 @@
+# Compares the sampled estimates of drcctlib_instr_analysis with an exact run and
+# reports the run time of each sampling rate.
+#
+#   python3 sample_check.py $drrun ./p0_test_app
+#   python3 sample_check.py $drrun ./p0_mt_test_app 8
+#
+# The client writes its report into the current directory tree, the newest
+# instr_analysis*.out file after each run is taken as that run's report.
+#
+# Every context of the exact report with at least MIN_COUNT executions must be
+# estimated within ERROR_BOUND by every sampled run, otherwise the script exits with 1.
+
+import glob, os, re, subprocess, sys, time
+
+ERROR_BOUND = 0.1
+MIN_COUNT = 100000
+
+# client options of every measured run, the first one is the reference
+CONFIGS = [
+	[ ],
+	[ "-sample", "10" ],
+	[ "-sample", "100" ],
+	[ "-sample", "1000" ],
+	[ "-sample_burst", "100", "900" ],
+	[ "-sample_burst", "1000", "9000" ],
+]
+
+def run( cmd ):
+	start = time.time()
+	subprocess.run( cmd, stdout=subprocess.DEVNULL, check=True )
+	return time.time() - start
+
+def newest_report( since ):
+	files = [ f for f in glob.glob( "**/*instr_analysis*.out", recursive=True )
+		if "snapshot" not in f and os.path.getmtime( f ) >= since ]
+	if not files:
+		sys.exit( "no instr_analysis report found" )
+	return max( files, key=os.path.getmtime )
+
+# {instruction type: (total, {backtrace: count})}
+def parse_report( path ):
+	report = { }
+	instr_type = None
+	count = None
+	backtrace = None
+	for line in open( path ):
+		line = line.rstrip( "\n" )
+		m = re.match( r"^(MEMORY LOAD|MEMORY STORE|CONDITIONAL BRANCHES|UNCONDITIONAL BRANCHES) : (\d+)$", line )
+		if m:
+			instr_type = m.group( 1 )
+			report[ instr_type ] = ( int( m.group( 2 ) ), { } )
+			continue
+		m = re.match( r"^\[NO\. \d+\]Ins call times (\d+)$", line, re.I )
+		if m:
+			count = int( m.group( 1 ) )
+			continue
+		if line.startswith( "=====" ):
+			if backtrace is None:
+				backtrace = [ ]
+			else:
+				report[ instr_type ][ 1 ][ "\n".join( backtrace ) ] = count
+				backtrace = None
+			continue
+		if backtrace is not None:
+			# the process root carries the pid, which differs between runs
+			backtrace.append( re.sub( r"PROCESS\[\d+\]", "PROCESS", line ) )
+	return report
+
+# prints the errors, returns the number of contexts out of bounds
+def compare( exact, sampled ):
+	violations = 0
+	for instr_type, ( total, contexts ) in exact.items( ):
+		est_total, est_contexts = sampled.get( instr_type, ( 0, { } ) )
+		total_err = abs( est_total - total ) / total if total else 0.0
+		errs = [ ]
+		for backtrace, count in contexts.items( ):
+			est = est_contexts.get( backtrace, 0 )
+			err = abs( est - count ) / count if count else 0.0
+			errs.append( err )
+			if count >= MIN_COUNT and err > ERROR_BOUND:
+				violations += 1
+		overlap = len( set( contexts ) & set( est_contexts ) )
+		max_err = max( errs ) if errs else 0.0
+		print( "    %-24s total err %6.2f%%  top err max %6.2f%%  top overlap %d/%d"
+			% ( instr_type, 100 * total_err, 100 * max_err, overlap, len( contexts ) ) )
+	return violations
+
+def main( ):
+	if len( sys.argv ) < 3:
+		sys.exit( "usage: sample_check.py <drrun> <app> [app args]" )
+	drrun = sys.argv[ 1 ]
+	app = sys.argv[ 2: ]
+
+	native = run( app )
+	print( "native %.2fs" % native )
+	exact = None
+	exact_time = None
+	violations = 0
+	for options in CONFIGS:
+		since = time.time( )
+		elapsed = run( [ drrun, "-t", "drcctlib_instr_analysis" ] + options + [ "--" ] + app )
+		report = parse_report( newest_report( since ) )
+		name = " ".join( options ) if options else "exact"
+		if exact is None:
+			exact = report
+			exact_time = elapsed
+			print( "%s %.2fs (%.1fx native)" % ( name, elapsed, elapsed / native ) )
+			continue
+		print( "%s %.2fs (%.1fx native, %.1f%% of the exact run)"
+			% ( name, elapsed, elapsed / native, 100 * elapsed / exact_time ) )
+		violations += compare( exact, report )
+	if violations:
+		sys.exit( "FAIL: %d context estimates off by more than %d%%"
+			% ( violations, 100 * ERROR_BOUND ) )
+	print( "PASS" )
+
+main( )
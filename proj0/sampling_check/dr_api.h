@@ -0,0 +1,52 @@
+/* Stand-ins for the DynamoRIO calls drcctlib_sampling.h makes, so that
+ * sampling_check.cpp builds without DynamoRIO. The raw TLS slots are one static
+ * buffer, the check runs a single thread. */
+
+#ifndef _SAMPLING_CHECK_DR_API_H_
+#define _SAMPLING_CHECK_DR_API_H_
+
+#include <stdint.h>
+#include <string.h>
+
+typedef unsigned char byte;
+typedef uintptr_t ptr_uint_t;
+typedef intptr_t ptr_int_t;
+typedef unsigned int uint;
+typedef int reg_id_t;
+typedef struct _opnd_t {
+    int unused;
+} opnd_t;
+typedef struct _instr_t instr_t;
+typedef struct _instrlist_t instrlist_t;
+
+static void *sampling_check_tls[8];
+
+static inline bool
+dr_raw_tls_calloc(reg_id_t *segment_register, uint *offset, uint num_slots,
+                  uint alignment)
+{
+    memset(sampling_check_tls, 0, sizeof(sampling_check_tls));
+    *segment_register = 0;
+    *offset = 0;
+    return num_slots <= sizeof(sampling_check_tls) / sizeof(void *);
+}
+
+static inline bool
+dr_raw_tls_cfree(uint offset, uint num_slots)
+{
+    return true;
+}
+
+static inline void *
+dr_get_dr_segment_base(reg_id_t segment_register)
+{
+    return sampling_check_tls;
+}
+
+static inline void
+dr_insert_clean_call(void *drcontext, instrlist_t *ilist, instr_t *where, void *callee,
+                     bool save_fpstate, uint num_args, ...)
+{
+}
+
+#endif // _SAMPLING_CHECK_DR_API_H_
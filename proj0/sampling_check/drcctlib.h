@@ -0,0 +1 @@
+/* Stand-in for drcctlib.h, see dr_api.h. */
@@ -0,0 +1 @@
+/* Stand-in for drreg.h, see dr_api.h. */
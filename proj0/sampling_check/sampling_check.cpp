@@ -0,0 +1,64 @@
+// Checks the estimates of drcctlib_sampling.h per instrumented point: a loop body with
+// a fixed number of points, as p0_test_app's sub_fun loop has 5 points under
+// drcctlib_instr_analysis and 6 under instr_statistics_clean_call, runs 3,000,000 times
+// like in p0_test_app. Every point's estimate must be within 10% of its exact count,
+// for every sampling setting of run.sh and sample_check.py.
+//
+// ARM_CCTLIB selects the countdown inside sampled(), which makes the same decisions as
+// the inlined sub/jge of x86.
+//
+//   g++ -O2 -std=c++11 -Isampling_check sampling_check/sampling_check.cpp -o sampling_check/sampling_check
+//   ./sampling_check/sampling_check
+//
+// Exits with 1 and prints the points out of bounds otherwise.
+
+#define ARM_CCTLIB
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../drcctlib_sampling.h"
+
+#define ITERATION_NUM 3000000
+#define ERROR_BOUND 0.1
+
+int
+main()
+{
+    // period, burst
+    const int32_t settings[][2] = { { 10, 1 },     { 100, 1 },      { 1000, 1 },
+                                    { 1000, 100 }, { 10000, 1000 } };
+    const int32_t point_nums[] = { 5, 6 };
+    int violation_num = 0;
+    for (auto &setting : settings) {
+        for (int32_t point_num : point_nums) {
+            sampler_t sampler;
+            sampler.init(setting[0], setting[1]);
+            std::vector<uint64_t> counts(point_num, 0);
+            for (int64_t i = 0; i < ITERATION_NUM; i++) {
+                for (int32_t p = 0; p < point_num; p++) {
+                    if (sampler.sampled()) {
+                        counts[p]++;
+                    }
+                }
+            }
+            double max_error = 0;
+            for (int32_t p = 0; p < point_num; p++) {
+                double error = (double)sampler.estimate(counts[p]) / ITERATION_NUM - 1;
+                error = error < 0 ? -error : error;
+                max_error = error > max_error ? error : max_error;
+                if (error > ERROR_BOUND) {
+                    printf("period %d burst %d, point %d of %d: estimate %llu, exact %d\n",
+                           setting[0], setting[1], p, point_num,
+                           (unsigned long long)sampler.estimate(counts[p]), ITERATION_NUM);
+                    violation_num++;
+                }
+            }
+            printf("period %5d burst %4d, %d points: max error %5.2f%%\n", setting[0],
+                   setting[1], point_num, 100 * max_error);
+            sampler.free();
+        }
+    }
+    printf("%s: %d points out of bounds\n", violation_num == 0 ? "PASS" : "FAIL",
+           violation_num);
+    return violation_num == 0 ? 0 : 1;
+}
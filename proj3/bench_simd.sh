@@ -0,0 +1,46 @@
+# Packed lane checks in profiler.cpp: SSE2 kernels against the per-lane scalar check, on
+# the SSE and AVX2 builds of simd_bench.
+#
+#   sh bench_simd.sh <profiler build dir> <drrun> <client name> [rounds]
+#
+# The profiler is rebuilt once per setting, so the build dir must be a configured cmake
+# tree of the client that compiles profiler.cpp. Its CMAKE_CXX_FLAGS are extended, and
+# restored and rebuilt on exit.
+#
+# Fails if no packed instruction reaches the check: then the framework does not call
+# OnAfterInsExec for instructions it does not classify and the packed path is dead.
+build=$1
+drrun=$2
+client=$3
+n=${4:-10000}
+
+flags=$(sed -n 's/^CMAKE_CXX_FLAGS:[A-Z]*=//p' $build/CMakeCache.txt)
+restore() {
+    cmake -DCMAKE_CXX_FLAGS="$flags" $build > /dev/null
+    make -C $build > /dev/null
+}
+trap restore EXIT
+
+# -fwrapv: the overflows are the point of the benchmark
+gcc -O3 -fwrapv simd_bench.c -o simd_bench_sse
+gcc -O3 -fwrapv -mavx2 simd_bench.c -o simd_bench_avx2
+for app in simd_bench_sse simd_bench_avx2; do
+    echo "$app native"
+    time ./$app $n > /dev/null
+done
+
+# 1: SSE2 kernels, 0: scalar check lane by lane
+for kernels in 1 0; do
+    cmake -DCMAKE_CXX_FLAGS="$flags -DPROFILER_SIMD_KERNELS=$kernels" $build > /dev/null
+    make -C $build > /dev/null
+    for app in simd_bench_sse simd_bench_avx2; do
+        echo "PROFILER_SIMD_KERNELS=$kernels $app"
+        time $drrun -t $client -- ./$app $n > /dev/null
+        grep -A1 "=>LANES" integer-overflow-profile.txt | head -4
+        packed=$(sed -n 's/^PACKED INSTRUCTIONS //p' integer-overflow-profile.txt)
+        if [ "${packed:-0}" -eq 0 ]; then
+            echo "FAIL: no packed instruction reached OnAfterInsExec"
+            exit 1
+        fi
+    done
+done
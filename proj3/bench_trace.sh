@@ -0,0 +1,23 @@
+# Overhead of the PROFILER_TRACE_MODE settings in profiler.cpp on overflow_bench.
+#
+#   sh bench_trace.sh <profiler build dir> <drrun> <client name> [iterations]
+#
+# The profiler is rebuilt once per mode, so the build dir must be a configured cmake
+# tree of the client that compiles profiler.cpp.
+build=$1
+drrun=$2
+client=$3
+n=${4:-1000000}
+
+gcc -O1 overflow_bench.c -o overflow_bench
+echo "native"
+time ./overflow_bench $n > /dev/null
+
+# 0: detection only, 1: binary ring buffer trace, 2: cout per instruction (the old default)
+for mode in 0 1 2; do
+    cmake -DCMAKE_CXX_FLAGS="-DPROFILER_TRACE_MODE=$mode" $build > /dev/null
+    make -C $build > /dev/null
+    echo "PROFILER_TRACE_MODE=$mode"
+    time $drrun -t $client -- ./overflow_bench $n > /dev/null
+done
+ls -l integer-overflow-trace.bin
@@ -0,0 +1,59 @@
+# Checks that PROFILER_STATIC_PRUNING in profiler.cpp loses no overflow: the profiler is
+# built with and without pruning, run on overflow_targets, and the per-context overflow
+# counts of both runs must match. Both runs must also find each of the 8 targets as one
+# context that overflowed once per round, as signed overflow or unsigned wraparound, so
+# both runs report wraparound (PROFILER_REPORT_WRAP).
+#
+#   sh check_pruning.sh <profiler build dir> <drrun> <client name> [rounds]
+#
+# The build dir must be a configured cmake tree of the client that compiles profiler.cpp.
+# Its CMAKE_CXX_FLAGS are extended, and restored and rebuilt on exit.
+build=$1
+drrun=$2
+client=$3
+n=${4:-1000}
+targets="add32|sub32|shl32|mul32|neg32|inc32|add64|wrap32"
+
+flags=$(sed -n 's/^CMAKE_CXX_FLAGS:[A-Z]*=//p' $build/CMakeCache.txt)
+restore() {
+    cmake -DCMAKE_CXX_FLAGS="$flags" $build > /dev/null
+    make -C $build > /dev/null
+}
+trap restore EXIT
+
+gcc -g -O1 overflow_targets.c -o overflow_targets
+
+for pruning in 0 1; do
+    defines="-DPROFILER_REPORT_WRAP=1 -DPROFILER_STATIC_PRUNING=$pruning"
+    cmake -DCMAKE_CXX_FLAGS="$flags $defines" $build > /dev/null
+    make -C $build > /dev/null
+    $drrun -t $client -- ./overflow_targets $n > /dev/null
+    head -3 integer-overflow-profile.txt
+    # one line per context: leaf pc, signed count, unsigned count
+    awk '/^(INTEGER OVERFLOW|UNSIGNED WRAPAROUND)$/ { getline; pc = $0 }
+         /^=>OCCURRENCES/ { getline; s = $0 }
+         /^=>UNSIGNED WRAPAROUNDS/ { getline; print pc, s, $0 }' \
+        integer-overflow-profile.txt | sort > overflows_pruning_$pruning.txt
+    # the rest of the process, e.g. hashing in the loader, may wrap as well
+    grep -wE "$targets" overflows_pruning_$pruning.txt > targets_pruning_$pruning.txt
+    found=$(wc -l < targets_pruning_$pruning.txt)
+    if [ "$found" -ne 8 ]; then
+        echo "FAIL: pruning $pruning found $found of the 8 target contexts"
+        exit 1
+    fi
+    # the last two fields are the counts, one of them is n, the other 0 or n
+    if ! awk -v n=$n '{ s = $(NF - 1); u = $NF }
+                     (s != n && u != n) || (s != 0 && s != n) || (u != 0 && u != n) {
+                         print "FAIL: " $0; bad = 1 }
+                     END { exit bad }' targets_pruning_$pruning.txt; then
+        echo "FAIL: pruning $pruning, a target did not overflow once per round"
+        exit 1
+    fi
+done
+
+if diff overflows_pruning_0.txt overflows_pruning_1.txt; then
+    echo "PASS: $(wc -l < overflows_pruning_1.txt) overflowing contexts, same counts with pruning"
+else
+    echo "FAIL: pruning changed the overflow counts"
+    exit 1
+fi
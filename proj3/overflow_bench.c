@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+// Workload for the profiler benchmarks: a hot loop of add, sub and shl where one
+// iteration in 1000 overflows. argv[1] is the iteration count.
+static volatile int sink;
+int main(int argc, char *argv[]){
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    volatile int a = 1, b = 2, s = 3;
+    for(long i = 0; i < n; i++){
+        int x = (i % 1000 == 0) ? INT_MAX : (int)i;
+        sink = x + a;
+        sink = x - b;
+        sink = a << s;
+    }
+    printf("%d\n", sink);
+    return 0;
+}
@@ -0,0 +1,185 @@
+/* overflow_predicates.h
+ *
+ * Overflow predicates of profiler.cpp, one instance per integer width T (int8_t ..
+ * int64_t). a and b are the sources and r is the destination after the instruction, all
+ * sign-extended to 64 bits; adc and sbb need r because the incoming carry is no operand.
+ * Every predicate returns true on overflow and is branchless: the compiler builtins
+ * compile to the operation plus seto/setc, the rest are sign-bit tricks (Hacker's
+ * Delight 2-13) and conditional moves.
+ *
+ * predicate_bench.cpp measures them against the old branching versions,
+ * predicate_check.cpp checks them against exact arithmetic.
+ */
+
+#ifndef _OVERFLOW_PREDICATES_H_
+#define _OVERFLOW_PREDICATES_H_
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace overflow_predicates {
+
+template <typename T> using unsigned_t = typename std::make_unsigned<T>::type;
+
+// top bit of the width
+template <typename T>
+static inline bool
+SignBit(uint64_t value)
+{
+    return (value >> (sizeof(T) * 8 - 1)) & 1;
+}
+
+template <typename T>
+static inline bool
+safe_add(int64_t a, int64_t b, int64_t /* r */)
+{
+    T out;
+    return __builtin_add_overflow((T)a, (T)b, &out);
+}
+
+template <typename T>
+static inline bool
+safe_sub(int64_t a, int64_t b, int64_t /* r */)
+{
+    T out;
+    return __builtin_sub_overflow((T)a, (T)b, &out);
+}
+
+// the count the hardware shifts by: masked to 5 bits, 6 for 64-bit operands
+template <typename T>
+static inline uint32_t
+ShiftCount(int64_t b)
+{
+    return (uint32_t)b & (sizeof(T) == 8 ? 63 : 31);
+}
+
+// a value bit or the sign is shifted out: shifting back does not give a
+template <typename T>
+static inline bool
+safe_shl(int64_t a, int64_t b, int64_t /* r */)
+{
+    const uint32_t bits = sizeof(T) * 8;
+    // only 8 and 16-bit counts can still be >= bits, everything is shifted out
+    uint32_t count = ShiftCount<T>(b);
+    bool in_range = count < bits;
+    count = in_range ? count : 0;
+    T shifted = (T)((unsigned_t<T>)(T)a << count);
+    bool lost = (T)(shifted >> count) != (T)a;
+    return in_range ? lost : (T)a != 0;
+}
+
+template <typename T>
+static inline bool
+safe_imul(int64_t a, int64_t b, int64_t /* r */)
+{
+    T out;
+    return __builtin_mul_overflow((T)a, (T)b, &out);
+}
+
+template <typename T>
+static inline bool
+safe_inc(int64_t a, int64_t /* b */, int64_t /* r */)
+{
+    return (T)a == std::numeric_limits<T>::max();
+}
+
+template <typename T>
+static inline bool
+safe_dec(int64_t a, int64_t /* b */, int64_t /* r */)
+{
+    return (T)a == std::numeric_limits<T>::min();
+}
+
+template <typename T>
+static inline bool
+safe_neg(int64_t a, int64_t /* b */, int64_t /* r */)
+{
+    return (T)a == std::numeric_limits<T>::min();
+}
+
+// same signs in, the other sign out
+template <typename T>
+static inline bool
+safe_adc(int64_t a, int64_t b, int64_t r)
+{
+    return SignBit<T>(((uint64_t)a ^ (uint64_t)r) & ((uint64_t)b ^ (uint64_t)r));
+}
+
+template <typename T>
+static inline bool
+safe_sbb(int64_t a, int64_t b, int64_t r)
+{
+    return SignBit<T>(((uint64_t)a ^ (uint64_t)b) & ((uint64_t)a ^ (uint64_t)r));
+}
+
+// unsigned wraparound, what CF reports
+
+template <typename T>
+static inline bool
+safe_add_unsigned(int64_t a, int64_t b, int64_t /* r */)
+{
+    unsigned_t<T> out;
+    return __builtin_add_overflow((unsigned_t<T>)a, (unsigned_t<T>)b, &out);
+}
+
+template <typename T>
+static inline bool
+safe_sub_unsigned(int64_t a, int64_t b, int64_t /* r */)
+{
+    return (unsigned_t<T>)a < (unsigned_t<T>)b;
+}
+
+// a set bit is shifted out
+template <typename T>
+static inline bool
+safe_shl_unsigned(int64_t a, int64_t b, int64_t /* r */)
+{
+    const uint32_t bits = sizeof(T) * 8;
+    uint32_t count = ShiftCount<T>(b);
+    bool in_range = count < bits;
+    count = in_range ? count : 0;
+    unsigned_t<T> ua = (unsigned_t<T>)a;
+    bool lost = (unsigned_t<T>)((unsigned_t<T>)(ua << count) >> count) != ua;
+    return in_range ? lost : ua != 0;
+}
+
+// carry out of the top bit: (a & b) | ((a | b) & ~r)
+template <typename T>
+static inline bool
+safe_adc_unsigned(int64_t a, int64_t b, int64_t r)
+{
+    uint64_t ua = a, ub = b, ur = r;
+    return SignBit<T>((ua & ub) | ((ua | ub) & ~ur));
+}
+
+// borrow out of the top bit: (~a & b) | (~(a ^ b) & r)
+template <typename T>
+static inline bool
+safe_sbb_unsigned(int64_t a, int64_t b, int64_t r)
+{
+    uint64_t ua = a, ub = b, ur = r;
+    return SignBit<T>((~ua & ub) | (~(ua ^ ub) & ur));
+}
+
+typedef bool (*overflow_check_t)(int64_t a, int64_t b, int64_t r);
+
+// index of an operand size in bytes into WIDTH_CHECKS tables, -1 if it is no integer
+// width
+static inline int
+WidthIndex(uint8_t bytes)
+{
+    return (bytes & (bytes - 1)) != 0 || bytes == 0 || bytes > 8 ? -1
+                                                                 : __builtin_ctz(bytes);
+}
+
+} // namespace overflow_predicates
+
+// the instances of a predicate, indexed by WidthIndex
+#define WIDTH_CHECKS(check)                                                            \
+    {                                                                                  \
+        overflow_predicates::check<int8_t>, overflow_predicates::check<int16_t>,       \
+            overflow_predicates::check<int32_t>, overflow_predicates::check<int64_t>   \
+    }
+
+#endif // _OVERFLOW_PREDICATES_H_
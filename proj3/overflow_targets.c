@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+// Known overflow targets for check_pruning.sh. Every target overflows once per call,
+// the deep frames around them give the pruning plenty of stack pointer arithmetic.
+// argv[1] is the number of rounds.
+static volatile int vi_max = INT_MAX, vi_min = INT_MIN, vi_one = 1, vi_two = 2;
+static volatile long vl_max = LONG_MAX;
+static volatile unsigned vu_max = UINT_MAX;
+static volatile int sink;
+static volatile long lsink;
+
+__attribute__((noinline)) static void add32(void){ sink = vi_max + vi_one; }
+__attribute__((noinline)) static void sub32(void){ sink = vi_min - vi_one; }
+__attribute__((noinline)) static void shl32(void){ sink = vi_max << vi_two; }
+__attribute__((noinline)) static void mul32(void){ sink = vi_max * vi_two; }
+__attribute__((noinline)) static void neg32(void){ sink = -vi_min; }
+__attribute__((noinline)) static void inc32(void){ int x = vi_max; x++; sink = x; }
+__attribute__((noinline)) static void add64(void){ lsink = vl_max + vi_one; }
+__attribute__((noinline)) static void wrap32(void){ sink = (int)(vu_max + 1u); }
+
+// local buffers force sub rsp / add rsp in every frame
+__attribute__((noinline)) static int frame(int depth){
+    char buf[256];
+    memset(buf, depth, sizeof(buf));
+    if(depth == 0){
+        add32(); sub32(); shl32(); mul32(); neg32(); inc32(); add64(); wrap32();
+        return buf[0];
+    }
+    return frame(depth - 1) + buf[depth];
+}
+
+int main(int argc, char *argv[]){
+    long n = argc > 1 ? atol(argv[1]) : 1000;
+    int r = 0;
+    for(long i = 0; i < n; i++){
+        r += frame(8);
+    }
+    printf("%d\n", r);
+    return 0;
+}
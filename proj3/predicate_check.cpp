@@ -0,0 +1,268 @@
+// Correctness check of the overflow predicates in overflow_predicates.h against exact
+// 128-bit arithmetic. 8 and 16 bits are checked exhaustively, every a and b (shift
+// counts from -8 to 2 * bits + 8) and both carries for adc/sbb, with the predicates
+// inlined so that the 2^32 16-bit pairs take under two minutes. Shift counts are masked
+// to 5 bits, 6 for 64-bit, as the hardware does. 32 and 64 bits get random
+// operands, biased towards the boundaries, and go through the WIDTH_CHECKS tables as in
+// profiler.cpp. Prints the mismatches per check and exits with 1 on any.
+//
+//   g++ -O2 -std=c++11 predicate_check.cpp -o predicate_check
+//   ./predicate_check [samples]
+
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include "overflow_predicates.h"
+
+using namespace overflow_predicates;
+
+typedef __int128 int128_t;
+typedef unsigned __int128 uint128_t;
+
+enum op_t { ADD, SUB, SHL, IMUL, INC, DEC, NEG, ADC, SBB };
+
+struct check_t {
+    const char *name;
+    overflow_check_t checks[4];
+    op_t op;
+    bool is_unsigned;
+    uint64_t mismatches;
+};
+
+static check_t checks[] = {
+    { "add", WIDTH_CHECKS(safe_add), ADD, false, 0 },
+    { "sub", WIDTH_CHECKS(safe_sub), SUB, false, 0 },
+    { "shl", WIDTH_CHECKS(safe_shl), SHL, false, 0 },
+    { "imul", WIDTH_CHECKS(safe_imul), IMUL, false, 0 },
+    { "inc", WIDTH_CHECKS(safe_inc), INC, false, 0 },
+    { "dec", WIDTH_CHECKS(safe_dec), DEC, false, 0 },
+    { "neg", WIDTH_CHECKS(safe_neg), NEG, false, 0 },
+    { "adc", WIDTH_CHECKS(safe_adc), ADC, false, 0 },
+    { "sbb", WIDTH_CHECKS(safe_sbb), SBB, false, 0 },
+    { "add_unsigned", WIDTH_CHECKS(safe_add_unsigned), ADD, true, 0 },
+    { "sub_unsigned", WIDTH_CHECKS(safe_sub_unsigned), SUB, true, 0 },
+    { "shl_unsigned", WIDTH_CHECKS(safe_shl_unsigned), SHL, true, 0 },
+    { "adc_unsigned", WIDTH_CHECKS(safe_adc_unsigned), ADC, true, 0 },
+    { "sbb_unsigned", WIDTH_CHECKS(safe_sbb_unsigned), SBB, true, 0 },
+};
+#define CHECK_NUM (sizeof(checks) / sizeof(checks[0]))
+
+// value sign-extended from the low bits, as the profiler reads operands
+static inline int64_t
+SignExtend(uint64_t value, int bits)
+{
+    int shift = 64 - bits;
+    return (int64_t)(value << shift) >> shift;
+}
+
+// shift count after the hardware masks it
+static inline int64_t
+MaskedCount(int64_t b, int bits)
+{
+    return b & (bits == 64 ? 63 : 31);
+}
+
+// exact result of the instruction on a and b, signed or unsigned as the check reads them
+static inline int128_t
+Exact(op_t op, bool is_unsigned, int64_t a, int64_t b, int carry, int bits)
+{
+    int128_t x = a, y = b;
+    if (is_unsigned) {
+        uint64_t mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+        x = (uint64_t)a & mask;
+        y = (uint64_t)b & mask;
+    }
+    switch (op) {
+    case ADD: return x + y;
+    case SUB: return x - y;
+    // only called with a masked count below 64
+    case SHL: return x * ((int128_t)1 << b);
+    case IMUL: return x * y;
+    case INC: return x + 1;
+    case DEC: return x - 1;
+    case NEG: return -x;
+    case ADC: return x + y + carry;
+    default: return x - y - carry;
+    }
+}
+
+// true if the exact result does not fit the width
+static bool
+Reference(op_t op, bool is_unsigned, int64_t a, int64_t b, int carry, int bits)
+{
+    if (op == SHL) {
+        uint64_t mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+        bool nonzero = ((uint64_t)a & mask) != 0;
+        b = MaskedCount(b, bits);
+        if (b >= bits) {
+            return nonzero;
+        }
+    }
+    int128_t exact = Exact(op, is_unsigned, a, b, carry, bits);
+    int128_t min = is_unsigned ? 0 : -((int128_t)1 << (bits - 1));
+    int128_t max =
+        is_unsigned ? ((int128_t)1 << bits) - 1 : ((int128_t)1 << (bits - 1)) - 1;
+    return exact < min || exact > max;
+}
+
+// the destination register after the instruction, which adc/sbb read the carry from
+static inline int64_t
+Destination(op_t op, int64_t a, int64_t b, int carry, int bits)
+{
+    if (op == SHL) {
+        b = MaskedCount(b, bits);
+        if (b >= bits) {
+            return 0;
+        }
+    }
+    return SignExtend((uint64_t)(uint128_t)Exact(op, false, a, b, carry, bits), bits);
+}
+
+static void
+Mismatch(check_t *check, int bits, int64_t a, int64_t b, int carry, int64_t r,
+         bool expected)
+{
+    if (check->mismatches++ < 4) {
+        printf("%s %d: a %lld b %lld carry %d r %lld, expected %d\n", check->name, bits,
+               (long long)a, (long long)b, carry, (long long)r, expected);
+    }
+}
+
+static void
+Check(check_t *check, int width, int64_t a, int64_t b, int carry)
+{
+    int bits = 8 << width;
+    int64_t r = Destination(check->op, a, b, carry, bits);
+    bool expected = Reference(check->op, check->is_unsigned, a, b, carry, bits);
+    if (check->checks[width](a, b, r) != expected) {
+        Mismatch(check, bits, a, b, carry, r, expected);
+    }
+}
+
+// Check() of every two-source predicate of T, in 64-bit arithmetic, which is exact
+// for 8 and 16 bits
+template <typename T>
+static inline void
+CheckPairInline(int64_t a, int64_t b)
+{
+    const int bits = sizeof(T) * 8;
+    const int64_t min = std::numeric_limits<T>::min();
+    const int64_t max = std::numeric_limits<T>::max();
+    const int64_t umax = ((int64_t)1 << bits) - 1;
+    const int64_t ua = a & umax, ub = b & umax;
+#define EXPECT(idx, got, expected, carry, r)                    \
+    if ((got) != (expected)) {                                  \
+        Mismatch(&checks[idx], bits, a, b, carry, r, expected); \
+    }
+    int64_t sum = a + b, diff = a - b, prod = a * b;
+    int64_t r_sum = (T)sum, r_diff = (T)diff;
+    EXPECT(0, safe_add<T>(a, b, r_sum), sum < min || sum > max, 0, r_sum);
+    EXPECT(1, safe_sub<T>(a, b, r_diff), diff < min || diff > max, 0, r_diff);
+    EXPECT(3, safe_imul<T>(a, b, (T)prod), prod < min || prod > max, 0, (T)prod);
+    EXPECT(9, safe_add_unsigned<T>(a, b, r_sum), ua + ub > umax, 0, r_sum);
+    EXPECT(10, safe_sub_unsigned<T>(a, b, r_diff), ua < ub, 0, r_diff);
+    for (int carry = 0; carry < 2; carry++) {
+        int64_t adc = sum + carry, sbb = diff - carry;
+        int64_t r_adc = (T)adc, r_sbb = (T)sbb;
+        EXPECT(7, safe_adc<T>(a, b, r_adc), adc < min || adc > max, carry, r_adc);
+        EXPECT(8, safe_sbb<T>(a, b, r_sbb), sbb < min || sbb > max, carry, r_sbb);
+        EXPECT(12, safe_adc_unsigned<T>(a, b, r_adc), ua + ub + carry > umax, carry,
+               r_adc);
+        EXPECT(13, safe_sbb_unsigned<T>(a, b, r_sbb), ua < ub + carry, carry, r_sbb);
+    }
+#undef EXPECT
+}
+
+static void
+CheckAll(int width, int64_t a, int64_t b)
+{
+    for (size_t i = 0; i < CHECK_NUM; i++) {
+        if (checks[i].op == SHL) {
+            continue;
+        }
+        Check(&checks[i], width, a, b, 0);
+        if (checks[i].op == ADC || checks[i].op == SBB) {
+            Check(&checks[i], width, a, b, 1);
+        }
+    }
+}
+
+static void
+CheckShifts(int width, int64_t a)
+{
+    int bits = 8 << width;
+    for (int64_t b = -8; b <= 2 * bits + 8; b++) {
+        for (size_t i = 0; i < CHECK_NUM; i++) {
+            if (checks[i].op == SHL) {
+                Check(&checks[i], width, a, b, 0);
+            }
+        }
+    }
+}
+
+template <typename T>
+static void
+CheckExhaustive(int width)
+{
+    const int bits = sizeof(T) * 8;
+    for (uint64_t ua = 0; ua < (1ull << bits); ua++) {
+        int64_t a = SignExtend(ua, bits);
+        for (uint64_t ub = 0; ub < (1ull << bits); ub++) {
+            CheckPairInline<T>(a, SignExtend(ub, bits));
+        }
+        // the one-source and shift checks are cheap enough for the generic path
+        for (size_t i = 0; i < CHECK_NUM; i++) {
+            if (checks[i].op == INC || checks[i].op == DEC || checks[i].op == NEG) {
+                Check(&checks[i], width, a, 0, 0);
+            }
+        }
+        CheckShifts(width, a);
+    }
+}
+
+// uniform, small, or near 0 / min / max of the width
+static int64_t
+RandomOperand(std::mt19937_64 &gen, int bits)
+{
+    uint64_t value = gen();
+    switch (gen() % 4) {
+    case 0: break;
+    case 1: value >>= gen() % 64; break;
+    case 2: value = (gen() % 8) - 4; break;
+    default: value = (1ull << (bits - 1)) + (gen() % 8) - 4; break;
+    }
+    return SignExtend(value, bits);
+}
+
+static void
+CheckRandom(int width, uint64_t samples)
+{
+    std::mt19937_64 gen(width);
+    int bits = 8 << width;
+    for (uint64_t i = 0; i < samples; i++) {
+        int64_t a = RandomOperand(gen, bits);
+        CheckAll(width, a, RandomOperand(gen, bits));
+        if (i % 64 == 0) {
+            CheckShifts(width, a);
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint64_t samples = argc > 1 ? strtoull(argv[1], NULL, 10) : 1 << 24;
+    CheckExhaustive<int8_t>(0);
+    CheckExhaustive<int16_t>(1);
+    CheckRandom(2, samples);
+    CheckRandom(3, samples);
+    int failed = 0;
+    for (size_t i = 0; i < CHECK_NUM; i++) {
+        printf("%-14s %llu mismatches\n", checks[i].name,
+               (unsigned long long)checks[i].mismatches);
+        failed |= checks[i].mismatches != 0;
+    }
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
@@ -2,13 +2,77 @@
 #include <iostream>
 #include <bitset>
 #include <cstdint>
-#include <cmath>
+#include <cstring>
 #include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include <emmintrin.h>
 #include "profiler.h"
+#include "overflow_predicates.h"
 #include "drcctlib_vscodeex_format.h"
 
+// Tracing of every checked instruction, off by default:
+// PROFILER_TRACE_OFF      only overflows are recorded
+// PROFILER_TRACE_BUFFER   one binary trace_record_t per instruction into a per-thread
+//                         ring buffer, a client thread drains the buffers into
+//                         integer-overflow-trace.bin (read it with trace_view.py)
+// PROFILER_TRACE_CONSOLE  the original cout line per instruction
+#define PROFILER_TRACE_OFF 0
+#define PROFILER_TRACE_BUFFER 1
+#define PROFILER_TRACE_CONSOLE 2
+#ifndef PROFILER_TRACE_MODE
+#    define PROFILER_TRACE_MODE PROFILER_TRACE_OFF
+#endif
+
+// With PROFILER_VALUE_RANGE, every execution of a checked scalar instruction also
+// records the min/max result and how many bits were left before it would overflow, per
+// context. The statistics are extra metrics of the .drcctprof profile.
+#ifndef PROFILER_VALUE_RANGE
+#    define PROFILER_VALUE_RANGE 0
+#endif
+
+// With PROFILER_REPORT_WRAP, unsigned wraparound (what CF reports for add, sub, shl, adc,
+// sbb and packed add/sub/shl) is checked as well. Contexts that only wrapped go to their
+// own UNSIGNED WRAPAROUND section and not to the CtxtContainer. Off by default: every
+// borrow and every add of a negative constant wraps, which would bury the signed
+// overflows.
+#ifndef PROFILER_REPORT_WRAP
+#    define PROFILER_REPORT_WRAP 0
+#endif
+
+#include "drmgr.h"
+
+// PROFILER_FLAGS_FILTER is a filter inside OnAfterInsExec, not an inline fast path: the
+// framework still makes the callback and the rule is still looked up for every
+// arithmetic instruction. What it saves is the operand decode and the software check,
+// which only run when OF (EFLAGS_OF, bit 11) or, for unsigned wraparound, CF (EFLAGS_CF,
+// bit 0) is set in flagsValue. shl still always takes the software check. EFLAGS_READ_OF,
+// used in profiler_overflow_bit.cpp, is DynamoRIO's mask for "instruction reads OF" and is
+// not that bit.
+#ifndef PROFILER_FLAGS_FILTER
+#    define PROFILER_FLAGS_FILTER 1
+#endif
+
+// With PROFILER_STATIC_PRUNING, arithmetic that cannot overflow in a meaningful way,
+// stack pointer adjustments and sub r, r, is decoded once and never checked again. It
+// stays instrumented: the callback and the rule cache lookup still run on every
+// execution, only the operand decode and the check are skipped.
+#ifndef PROFILER_STATIC_PRUNING
+#    define PROFILER_STATIC_PRUNING 1
+#endif
+
+// With PROFILER_SIMD_KERNELS, the lanes of packed add/sub results are checked with SSE2
+// 16 bytes at a time, without it lane by lane with the scalar rules (see bench_simd.sh).
+#ifndef PROFILER_SIMD_KERNELS
+#    define PROFILER_SIMD_KERNELS 1
+#endif
+
 using namespace std;
 using namespace DrCCTProf;
+using overflow_predicates::overflow_check_t;
+using overflow_predicates::WidthIndex;
 
 /*
     Tips: different integer types have distinct boundaries
@@ -37,210 +101,1217 @@ GetOpndIntValue(Operand opnd)
     return value;
 }
 
-static inline pair<int64_t, int64_t> 
-getMaxMin(uint8_t dst_bytes) {
-    int64_t min_int_val = 0;
-    int64_t max_int_val = 0;
-    switch (dst_bytes) {
-        case 1: 
-            min_int_val = std::numeric_limits<int8_t>::min();
-            max_int_val = std::numeric_limits<int8_t>::max();
-            break;
-        case 2: 
-            min_int_val = std::numeric_limits<int16_t>::min();
-            max_int_val = std::numeric_limits<int16_t>::max();
-            break;
-        case 4: 
-            min_int_val = std::numeric_limits<int32_t>::min();
-            max_int_val = std::numeric_limits<int32_t>::max();
-            break;
-        case 8: 
-            min_int_val = std::numeric_limits<int64_t>::min();
-            max_int_val = std::numeric_limits<int64_t>::max();
-            break;
-        default: 
-            cout << "in default case" << endl;
+typedef struct _arith_rule_t {
+    OperatorType op;
+    const char *name;
+    // one predicate per width, indexed by WidthIndex
+    overflow_check_t signed_check[4];
+    // NULL when the instruction has no unsigned meaning
+    overflow_check_t unsigned_check[4];
+    // a check can only fire if one of these flags is set, 0 if the flags do not tell
+    uint64_t flags_mask;
+} arith_rule_t;
+
+#define NO_WIDTH_CHECKS { NULL, NULL, NULL, NULL }
+
+// the index of a rule is its op code in the trace, see trace_view.py
+static const arith_rule_t arith_rules[] = {
+    { OperatorType::kOPadd, "add", WIDTH_CHECKS(safe_add), WIDTH_CHECKS(safe_add_unsigned),
+      EFLAGS_OF | EFLAGS_CF },
+    { OperatorType::kOPsub, "sub", WIDTH_CHECKS(safe_sub), WIDTH_CHECKS(safe_sub_unsigned),
+      EFLAGS_OF | EFLAGS_CF },
+    // OF is only defined for 1-bit shifts
+    { OperatorType::kOPshl, "shl", WIDTH_CHECKS(safe_shl), WIDTH_CHECKS(safe_shl_unsigned),
+      0 },
+    { OperatorType::kOPimul, "imul", WIDTH_CHECKS(safe_imul), NO_WIDTH_CHECKS, EFLAGS_OF },
+    // inc and dec leave CF alone
+    { OperatorType::kOPinc, "inc", WIDTH_CHECKS(safe_inc), NO_WIDTH_CHECKS, EFLAGS_OF },
+    { OperatorType::kOPdec, "dec", WIDTH_CHECKS(safe_dec), NO_WIDTH_CHECKS, EFLAGS_OF },
+    { OperatorType::kOPneg, "neg", WIDTH_CHECKS(safe_neg), NO_WIDTH_CHECKS, EFLAGS_OF },
+    { OperatorType::kOPadc, "adc", WIDTH_CHECKS(safe_adc), WIDTH_CHECKS(safe_adc_unsigned),
+      EFLAGS_OF | EFLAGS_CF },
+    { OperatorType::kOPsbb, "sbb", WIDTH_CHECKS(safe_sbb), WIDTH_CHECKS(safe_sbb_unsigned),
+      EFLAGS_OF | EFLAGS_CF },
+};
+#define ARITH_RULE_NUM (sizeof(arith_rules) / sizeof(arith_rules[0]))
+
+#define ARITH_RULE_ADD 0
+#define ARITH_RULE_SUB 1
+#define ARITH_RULE_SHL 2
+
+// Packed integer add/sub/shl. The framework only hands over scalar operands, so these
+// are found by decoding and their lanes are read from the machine context.
+//
+// This only works if the framework calls OnAfterInsExec for instructions it does not
+// classify (getOperatorType() is kOPunsupport). Its source is not part of this tree. The
+// profile reports PACKED INSTRUCTIONS, the packed instructions that reached the check,
+// and bench_simd.sh fails when simd_bench gets none, i.e. when the framework only calls
+// back for the scalar arithmetic and this path is dead. If it calls back for every
+// instruction, the unchecked ones cost one lock-free rule cache lookup each.
+typedef struct _simd_rule_t {
+    int opcode;
+    // lanes are checked with this arith_rules entry
+    int32_t arith_rule;
+    uint8_t lane_bytes;
+    // VEX form: dst, src0, src1; SSE form: dst is also the first source
+    bool is_vex;
+} simd_rule_t;
+
+// The legacy SSE shifts are missing on purpose: their only source is overwritten and
+// the shifted out bits can not be recovered from the result.
+static const simd_rule_t simd_rules[] = {
+    { OP_paddb, ARITH_RULE_ADD, 1, false },   { OP_paddw, ARITH_RULE_ADD, 2, false },
+    { OP_paddd, ARITH_RULE_ADD, 4, false },   { OP_paddq, ARITH_RULE_ADD, 8, false },
+    { OP_psubb, ARITH_RULE_SUB, 1, false },   { OP_psubw, ARITH_RULE_SUB, 2, false },
+    { OP_psubd, ARITH_RULE_SUB, 4, false },   { OP_psubq, ARITH_RULE_SUB, 8, false },
+    { OP_vpaddb, ARITH_RULE_ADD, 1, true },   { OP_vpaddw, ARITH_RULE_ADD, 2, true },
+    { OP_vpaddd, ARITH_RULE_ADD, 4, true },   { OP_vpaddq, ARITH_RULE_ADD, 8, true },
+    { OP_vpsubb, ARITH_RULE_SUB, 1, true },   { OP_vpsubw, ARITH_RULE_SUB, 2, true },
+    { OP_vpsubd, ARITH_RULE_SUB, 4, true },   { OP_vpsubq, ARITH_RULE_SUB, 8, true },
+    { OP_vpsllw, ARITH_RULE_SHL, 2, true },   { OP_vpslld, ARITH_RULE_SHL, 4, true },
+    { OP_vpsllq, ARITH_RULE_SHL, 8, true },
+};
+#define SIMD_RULE_NUM (sizeof(simd_rules) / sizeof(simd_rules[0]))
+
+// operands of one packed instruction, resolved when it is classified
+typedef struct _simd_instr_t {
+    const simd_rule_t *rule;
+    reg_id_t dst;
+    // 16 for xmm, 32 for ymm
+    uint8_t vec_bytes;
+    // a op b
+    opnd_t src[2];
+    // source that is dst, whose old value is rebuilt from the result, -1 if none
+    int8_t lost_src;
+} simd_instr_t;
+
+// NULL unless decoded is a packed instruction of simd_rules whose sources can be
+// recovered after it ran
+static simd_instr_t *
+FindSimdRule(instr_t *decoded)
+{
+    int opcode = instr_get_opcode(decoded);
+    const simd_rule_t *rule = NULL;
+    for (size_t i = 0; i < SIMD_RULE_NUM; i++) {
+        if (simd_rules[i].opcode == opcode) {
+            rule = &simd_rules[i];
             break;
+        }
+    }
+    // EVEX forms list the opmask as an extra first source, they are not handled, nor
+    // is zmm
+    if (rule == NULL || instr_num_dsts(decoded) != 1 || instr_num_srcs(decoded) != 2 ||
+        !opnd_is_reg(instr_get_dst(decoded, 0))) {
+        return NULL;
+    }
+    reg_id_t dst = opnd_get_reg(instr_get_dst(decoded, 0));
+    if (!reg_is_xmm(dst) && !reg_is_ymm(dst)) {
+        return NULL;
+    }
+    opnd_t src[2];
+    if (rule->is_vex) {
+        src[0] = instr_get_src(decoded, 0);
+        src[1] = instr_get_src(decoded, 1);
+    } else {
+        // DR lists the explicit source first
+        src[0] = instr_get_src(decoded, 1);
+        src[1] = instr_get_src(decoded, 0);
     }
-    std::pair <int64_t,int64_t> maxMin(min_int_val, max_int_val);
-    return maxMin;
+    int8_t lost_src = -1;
+    for (int8_t i = 0; i < 2; i++) {
+        if (opnd_is_reg(src[i]) && opnd_get_reg(src[i]) == dst) {
+            if (lost_src != -1) {
+                // paddd xmm0, xmm0
+                return NULL;
+            }
+            lost_src = i;
+        }
+    }
+    // a shifted value can not be rebuilt
+    if (rule->arith_rule == ARITH_RULE_SHL && lost_src != -1) {
+        return NULL;
+    }
+    simd_instr_t *simd = (simd_instr_t *)dr_global_alloc(sizeof(simd_instr_t));
+    simd->rule = rule;
+    simd->dst = dst;
+    simd->vec_bytes = reg_is_ymm(dst) ? 32 : 16;
+    simd->src[0] = src[0];
+    simd->src[1] = src[1];
+    simd->lost_src = lost_src;
+    return simd;
 }
 
-static inline bool
-safe_add(int64_t a, int64_t b, uint8_t dst_bytes)
+// The profiler has no init hook, locks are created by their first user.
+static void *
+GetLazyMutex(void *volatile *lock)
+{
+    if (*lock == NULL) {
+        void *new_lock = dr_mutex_create();
+        if (!__sync_bool_compare_and_swap(lock, NULL, new_lock)) {
+            dr_mutex_destroy(new_lock);
+        }
+    }
+    return *lock;
+}
+
+// Rule of each instruction by ip, so an instruction is classified on its first
+// execution only, including the ones that are not checked. The framework gives no hook
+// at block translation, so this is where pruning happens.
+//
+// Open addressing, at most half full, doubled when it would be more. Readers take no
+// lock: the rule index is written before the ip, a reader that sees the ip also sees
+// the index, and a grown table is filled before it is published. Replaced tables stay
+// allocated until exit since a reader may still probe them. The entries of an unloaded
+// module are dropped, its addresses may be reused by other code.
+#define RULE_CACHE_INIT_BITS 12
+
+#define RULE_NONE -1
+#define RULE_PRUNED -2
+#define RULE_SIMD -3
+
+typedef struct _rule_cache_entry_t {
+    app_pc ip;
+    // index into arith_rules, RULE_NONE, RULE_PRUNED or RULE_SIMD
+    int32_t rule_idx;
+    // operands of a RULE_SIMD instruction, never freed
+    simd_instr_t *simd;
+} rule_cache_entry_t;
+
+typedef struct _rule_cache_t {
+    int bits;
+    // used entries
+    uint32_t entry_num;
+    rule_cache_entry_t *entries;
+    // table this one replaced, freed at exit
+    struct _rule_cache_t *retired;
+} rule_cache_t;
+
+static rule_cache_t *volatile rule_cache = NULL;
+static void *volatile rule_cache_lock = NULL;
+// classified instructions, reported at exit
+static uint64_t checked_instr_num = 0;
+static uint64_t skipped_instr_num = 0;
+static uint64_t packed_instr_num = 0;
+
+static inline uint32_t
+RuleCacheSlot(app_pc ip, int bits)
 {
-    pair<int64_t, int64_t> maxMin = getMaxMin(dst_bytes);
-    int64_t min_int_val = maxMin.first;
-    int64_t max_int_val = maxMin.second;
+    return (uint32_t)(((uint64_t)ip * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+}
 
-    if (a > 0 && b > max_int_val - a)
-        return true;
-    
-    // in this case below: 
-    // min_int_val - a = min_int_val + a 
-    // because a < 0
-    else if (a < 0 && b < min_int_val - a) 
-        return true;
-    
-    else
-        return false;
-    return false;
+// entry of ip in cache, or the empty slot where it belongs
+static inline rule_cache_entry_t *
+ProbeRuleCache(rule_cache_t *cache, app_pc ip)
+{
+    uint32_t mask = (1u << cache->bits) - 1;
+    for (uint32_t slot = RuleCacheSlot(ip, cache->bits);; slot = (slot + 1) & mask) {
+        app_pc cached_ip = __atomic_load_n(&cache->entries[slot].ip, __ATOMIC_ACQUIRE);
+        if (cached_ip == ip || cached_ip == NULL) {
+            return &cache->entries[slot];
+        }
+    }
 }
 
-static inline bool
-safe_sub(int64_t a, int64_t b, uint8_t dst_bytes)
+// Copies the entries of old, except those in [skip_start, skip_end), into a new
+// table of 2^bits entries and publishes it. Called with rule_cache_lock held.
+static void
+RebuildRuleCache(rule_cache_t *old, int bits, app_pc skip_start, app_pc skip_end)
 {
-    pair<int64_t, int64_t> maxMin = getMaxMin(dst_bytes);
-    int64_t min_int_val = maxMin.first;
-    int64_t max_int_val = maxMin.second;
+    rule_cache_t *cache = (rule_cache_t *)dr_global_alloc(sizeof(rule_cache_t));
+    cache->bits = bits;
+    cache->entry_num = 0;
+    cache->entries =
+        (rule_cache_entry_t *)dr_global_alloc(sizeof(rule_cache_entry_t) << bits);
+    memset(cache->entries, 0, sizeof(rule_cache_entry_t) << bits);
+    cache->retired = old;
+    if (old != NULL) {
+        for (uint32_t i = 0; i < (1u << old->bits); i++) {
+            rule_cache_entry_t *entry = &old->entries[i];
+            if (entry->ip == NULL || (entry->ip >= skip_start && entry->ip < skip_end)) {
+                continue;
+            }
+            *ProbeRuleCache(cache, entry->ip) = *entry;
+            cache->entry_num++;
+        }
+    }
+    __atomic_store_n(&rule_cache, cache, __ATOMIC_RELEASE);
+}
 
-    // a - b = c
-    // max int val is 127
-    // min int val is -128
-    // 5 - -123
-    if (a > 0 && b < min_int_val + a)
-        return true;
-    
-    // in this case below: 
-    // min_int_val - a = min_int_val + a 
-    // because a < 0
-    // max int val is 127
-    // min int val is -128
-    // -5 - 123
-    else if (a < 0 && b > max_int_val + a + 1) 
-        return true;
-    
-    else
-        return false;
-    return false;
+static void
+OnRuleCacheModuleUnload(void *drcontext, const module_data_t *info)
+{
+    dr_mutex_lock(rule_cache_lock);
+    RebuildRuleCache(rule_cache, rule_cache->bits, info->start, info->end);
+    dr_mutex_unlock(rule_cache_lock);
 }
 
-static inline bool
-safe_shl(int64_t a, int64_t b, uint8_t dst_bytes)
+// called from OnBeforeAppExit, no instruction runs any more
+static void
+FreeRuleCache()
 {
-    pair<int64_t, int64_t> maxMin = getMaxMin(dst_bytes);
-    int64_t min_int_val = maxMin.first;
-    int64_t max_int_val = maxMin.second;
+    if (rule_cache == NULL) {
+        return;
+    }
+    dr_unregister_module_unload_event(OnRuleCacheModuleUnload);
+    rule_cache_t *cache = rule_cache;
+    rule_cache = NULL;
+    while (cache != NULL) {
+        rule_cache_t *retired = cache->retired;
+        dr_global_free(cache->entries, sizeof(rule_cache_entry_t) << cache->bits);
+        dr_global_free(cache, sizeof(rule_cache_t));
+        cache = retired;
+    }
+}
 
-    int16_t msb = floor(log2(a));
-    // 1 << 7 = 128
-    // max int for signed 8 bit int is 127
-    if (a > 0 && msb + b > dst_bytes - 2)
-        return true;
-    
-    // if a < 0 shl has undefined behavior in c++11
-    else
+static int32_t
+FindArithRule(OperatorType opType)
+{
+    for (size_t i = 0; i < ARITH_RULE_NUM; i++) {
+        if (arith_rules[i].op == opType) {
+            return (int32_t)i;
+        }
+    }
+    return RULE_NONE;
+}
+
+#if PROFILER_STATIC_PRUNING
+// true for instructions whose overflow means nothing:
+// add/sub rsp, ...   the stack pointer is an address, not an integer
+// sub r, r           always 0
+static bool
+IsProvablySafe(instr_t *decoded)
+{
+    if (instr_num_dsts(decoded) == 0 || !opnd_is_reg(instr_get_dst(decoded, 0))) {
         return false;
+    }
+    reg_id_t dst_reg = opnd_get_reg(instr_get_dst(decoded, 0));
+    if (reg_to_pointer_sized(dst_reg) == DR_REG_XSP) {
+        return true;
+    }
+    return instr_get_opcode(decoded) == OP_sub && instr_num_srcs(decoded) > 0 &&
+        opnd_is_reg(instr_get_src(decoded, 0)) &&
+        opnd_get_reg(instr_get_src(decoded, 0)) == dst_reg;
+}
+#endif
 
-    return false;
+// decodes the instruction once, for pruning and for the packed instructions the
+// framework does not classify
+static int32_t
+ClassifyInstruction(Instruction *instr, simd_instr_t **simd)
+{
+    int32_t rule_idx = FindArithRule(instr->getOperatorType());
+#if !PROFILER_STATIC_PRUNING
+    if (rule_idx != RULE_NONE) {
+        return rule_idx;
+    }
+#endif
+    void *drcontext = dr_get_current_drcontext();
+    instr_t decoded;
+    instr_init(drcontext, &decoded);
+    if (decode(drcontext, instr->ip, &decoded) != NULL) {
+        if (rule_idx == RULE_NONE) {
+            *simd = FindSimdRule(&decoded);
+            if (*simd != NULL) {
+                rule_idx = RULE_SIMD;
+            }
+        }
+#if PROFILER_STATIC_PRUNING
+        else if (IsProvablySafe(&decoded)) {
+            rule_idx = RULE_PRUNED;
+        }
+#endif
+    }
+    instr_free(drcontext, &decoded);
+    return rule_idx;
 }
 
+// Returns the entry of ip, which another thread may have added first.
+static void
+CacheInstrRule(app_pc ip, int32_t *rule_idx, simd_instr_t **simd)
+{
+    void *lock = GetLazyMutex(&rule_cache_lock);
+    dr_mutex_lock(lock);
+    if (rule_cache == NULL) {
+        RebuildRuleCache(NULL, RULE_CACHE_INIT_BITS, NULL, NULL);
+        dr_register_module_unload_event(OnRuleCacheModuleUnload);
+    }
+    rule_cache_entry_t *entry = ProbeRuleCache(rule_cache, ip);
+    if (entry->ip == ip) {
+        if (*simd != NULL) {
+            dr_global_free(*simd, sizeof(simd_instr_t));
+        }
+        *rule_idx = entry->rule_idx;
+        *simd = entry->simd;
+        dr_mutex_unlock(lock);
+        return;
+    }
+    if ((rule_cache->entry_num + 1) * 2 > (1u << rule_cache->bits)) {
+        RebuildRuleCache(rule_cache, rule_cache->bits + 1, NULL, NULL);
+        entry = ProbeRuleCache(rule_cache, ip);
+    }
+    entry->rule_idx = *rule_idx;
+    entry->simd = *simd;
+    __atomic_store_n(&entry->ip, ip, __ATOMIC_RELEASE);
+    rule_cache->entry_num++;
+    if (*rule_idx == RULE_PRUNED) {
+        skipped_instr_num++;
+    } else if (*rule_idx == RULE_SIMD) {
+        packed_instr_num++;
+    } else if (*rule_idx != RULE_NONE) {
+        checked_instr_num++;
+    }
+    dr_mutex_unlock(lock);
+}
+
+// index into arith_rules, or RULE_SIMD with *simd set, negative if not checked
+static inline int32_t
+GetInstrRule(Instruction *instr, simd_instr_t **simd)
+{
+    app_pc ip = instr->ip;
+    rule_cache_t *cache = __atomic_load_n(&rule_cache, __ATOMIC_ACQUIRE);
+    if (cache != NULL) {
+        rule_cache_entry_t *entry = ProbeRuleCache(cache, ip);
+        if (__atomic_load_n(&entry->ip, __ATOMIC_ACQUIRE) == ip) {
+            *simd = entry->simd;
+            return entry->rule_idx;
+        }
+    }
+    int32_t rule_idx = ClassifyInstruction(instr, simd);
+    CacheInstrRule(ip, &rule_idx, simd);
+    return rule_idx;
+}
+
+#define OVERFLOW_SIGNED 1
+#define OVERFLOW_UNSIGNED 2
+
 // implement your algorithm in this function
-static inline bool
-IntegerOverflow(OperatorType opType, uint64_t flagsValue, Operand src1, Operand src2,
-                Operand dst)
+// returns OVERFLOW_SIGNED | OVERFLOW_UNSIGNED bits, 0 without overflow
+static inline int
+IntegerOverflow(const arith_rule_t *rule, Operand src1, Operand src2, Operand dst)
 {
-    //cout << "Iniside Integer Overflow" << endl;
+    int width = WidthIndex(dst.size);
+    if (width < 0) {
+        return 0;
+    }
     int64_t src1_val = GetOpndIntValue(src1);
     int64_t src2_val = GetOpndIntValue(src2);
-    if (opType == OperatorType::kOPadd) {
-        bool is_overflow = safe_add(src1_val, src2_val, dst.size);
-        return is_overflow;
-    } else if (opType == OperatorType::kOPsub) {
-        bool is_overflow = safe_sub(src1_val, src2_val, dst.size);
-        return is_overflow;
-    } else if (opType == OperatorType::kOPshl) {
-        bool is_overflow = safe_shl(src1_val, src2_val, dst.size);
-        return is_overflow;
-    } else {
-        return false;
+    int64_t dst_val = GetOpndIntValue(dst);
+    int overflow_kind = 0;
+    if (rule->signed_check[width](src1_val, src2_val, dst_val)) {
+        overflow_kind |= OVERFLOW_SIGNED;
     }
-    return false;
+#if PROFILER_REPORT_WRAP
+    if (rule->unsigned_check[width] != NULL &&
+        rule->unsigned_check[width](src1_val, src2_val, dst_val)) {
+        overflow_kind |= OVERFLOW_UNSIGNED;
+    }
+#endif
+    return overflow_kind;
 }
 
-void
-OnAfterInsExec(Instruction *instr, context_handle_t contxt, uint64_t flagsValue,
-                        CtxtContainer *ctxtContainer)
+// One entry per overflowing context, so memory and the exit report grow with the
+// number of distinct contexts instead of the number of overflowing executions.
+typedef struct _overflow_stat_t {
+    // signed overflows
+    uint64_t count;
+    // unsigned wraparounds
+    uint64_t wrap_count;
+    // src0, src1, dst, of the lowest overflowing lane for packed instructions
+    int64_t first_operands[3];
+    int64_t last_operands[3];
+    // packed instructions: lanes that ever overflowed, lane size, 0 for scalars
+    uint32_t lane_mask;
+    uint8_t lane_bytes;
+} overflow_stat_t;
+
+typedef std::unordered_map<context_handle_t, overflow_stat_t> overflow_table_t;
+
+// one table per thread, merged at exit, so recording takes no lock
+static std::vector<overflow_table_t *> *overflow_tables = NULL;
+// contexts already handed to the CtxtContainer, by any thread
+static std::unordered_set<context_handle_t> *overflow_ctxts = NULL;
+static void *volatile overflow_lock = NULL;
+static int overflow_tls_idx = -1;
+
+static overflow_table_t *
+GetOverflowTable()
 {
-    OperatorType opType = instr->getOperatorType();
-    // add: Destination = Source0 + Source1
-    if (opType == OperatorType::kOPadd) {
-        Operand srcOpnd0 = instr->getSrcOperand(0);
-        Operand srcOpnd1 = instr->getSrcOperand(1);
-        Operand dstOpnd = instr->getDstOperand(0);
-        std::bitset<64> bitFlagsValue(flagsValue);
+    if (__atomic_load_n(&overflow_tls_idx, __ATOMIC_ACQUIRE) == -1) {
+        dr_mutex_lock(GetLazyMutex(&overflow_lock));
+        if (overflow_tls_idx == -1) {
+            overflow_tables = new std::vector<overflow_table_t *>();
+            overflow_ctxts = new std::unordered_set<context_handle_t>();
+            __atomic_store_n(&overflow_tls_idx, drmgr_register_tls_field(),
+                             __ATOMIC_RELEASE);
+        }
+        dr_mutex_unlock(overflow_lock);
+    }
+    void *drcontext = dr_get_current_drcontext();
+    overflow_table_t *table =
+        (overflow_table_t *)drmgr_get_tls_field(drcontext, overflow_tls_idx);
+    if (table == NULL) {
+        table = new overflow_table_t();
+        drmgr_set_tls_field(drcontext, overflow_tls_idx, table);
+        dr_mutex_lock(overflow_lock);
+        overflow_tables->push_back(table);
+        dr_mutex_unlock(overflow_lock);
+    }
+    return table;
+}
 
-        if (IntegerOverflow(opType, flagsValue, srcOpnd0, srcOpnd1, dstOpnd)) {
+static void
+RecordOverflow(context_handle_t contxt, int overflow_kind, int64_t src0, int64_t src1,
+               int64_t dst, uint32_t lane_mask, uint8_t lane_bytes,
+               CtxtContainer *ctxtContainer)
+{
+    int64_t operands[3] = { src0, src1, dst };
+    overflow_table_t *table = GetOverflowTable();
+    auto it = table->find(contxt);
+    if (it == table->end()) {
+        overflow_stat_t stat;
+        stat.count = 0;
+        stat.wrap_count = 0;
+        stat.lane_mask = 0;
+        stat.lane_bytes = lane_bytes;
+        memcpy(stat.first_operands, operands, sizeof(operands));
+        it = table->emplace(contxt, stat).first;
+    }
+    if ((overflow_kind & OVERFLOW_SIGNED) != 0 && it->second.count++ == 0) {
+        // The container only sees contexts with a signed overflow, each once. This is
+        // the first one of the context in this thread, so the lock stays off the
+        // per-overflow path.
+        dr_mutex_lock(overflow_lock);
+        if (overflow_ctxts->insert(contxt).second) {
             ctxtContainer->addCtxt(contxt);
         }
+        dr_mutex_unlock(overflow_lock);
+    }
+    if ((overflow_kind & OVERFLOW_UNSIGNED) != 0) {
+        it->second.wrap_count++;
+    }
+    it->second.lane_mask |= lane_mask;
+    memcpy(it->second.last_operands, operands, sizeof(operands));
+}
 
-        cout << "ip(" << hex << instr->ip << "):"
-             << "add " << dec << GetOpndIntValue(srcOpnd0) << " "
-             << GetOpndIntValue(srcOpnd1) << " -> " << GetOpndIntValue(dstOpnd) << " "
-             << bitFlagsValue << endl;
+// Sums the per-thread tables into merged and frees them. Contexts that overflowed in
+// several threads keep the first operands of the earliest registered thread and the
+// last operands of the latest one.
+static void
+MergeOverflowTables(overflow_table_t *merged)
+{
+    if (overflow_tables == NULL) {
+        return;
+    }
+    for (overflow_table_t *table : *overflow_tables) {
+        for (auto &entry : *table) {
+            const overflow_stat_t &stat = entry.second;
+            auto it = merged->find(entry.first);
+            if (it == merged->end()) {
+                merged->emplace(entry.first, stat);
+                continue;
+            }
+            overflow_stat_t &total = it->second;
+            total.count += stat.count;
+            total.wrap_count += stat.wrap_count;
+            total.lane_mask |= stat.lane_mask;
+            memcpy(total.last_operands, stat.last_operands, sizeof(stat.last_operands));
+        }
+        delete table;
+    }
+    delete overflow_tables;
+    overflow_tables = NULL;
+    delete overflow_ctxts;
+    overflow_ctxts = NULL;
+}
 
+// reads a source of a packed instruction, vec_bytes bytes of a register or memory, or
+// the immediate shift count
+static bool
+ReadSimdOperand(opnd_t opnd, dr_mcontext_t *mc, uint8_t vec_bytes, byte *value)
+{
+    if (opnd_is_reg(opnd)) {
+        return reg_get_value_ex(opnd_get_reg(opnd), mc, value);
+    }
+    if (opnd_is_immed_int(opnd)) {
+        memset(value, 0, vec_bytes);
+        uint64_t count = (uint64_t)opnd_get_immed_int(opnd);
+        memcpy(value, &count, sizeof(count));
+        return true;
+    }
+    if (opnd_is_memory_reference(opnd)) {
+        size_t size = opnd_size_in_bytes(opnd_get_size(opnd));
+        memset(value, 0, vec_bytes);
+        return size <= vec_bytes &&
+            dr_safe_read(opnd_compute_address(opnd, mc), size, value, NULL);
     }
+    return false;
+}
 
-    // sub: Destination = Source0 - Source1
-    if (opType == OperatorType::kOPsub) {
-        Operand srcOpnd0 = instr->getSrcOperand(0);
-        Operand srcOpnd1 = instr->getSrcOperand(1);
-        Operand dstOpnd = instr->getDstOperand(0);
-        std::bitset<64> bitFlagsValue(flagsValue);
+static inline __m128i
+LaneAdd(__m128i x, __m128i y, uint8_t lane_bytes)
+{
+    switch (lane_bytes) {
+    case 1: return _mm_add_epi8(x, y);
+    case 2: return _mm_add_epi16(x, y);
+    case 4: return _mm_add_epi32(x, y);
+    default: return _mm_add_epi64(x, y);
+    }
+}
 
-        if (IntegerOverflow(opType, flagsValue, srcOpnd0, srcOpnd1, dstOpnd)) {
-            ctxtContainer->addCtxt(contxt);
+static inline __m128i
+LaneSub(__m128i x, __m128i y, uint8_t lane_bytes)
+{
+    switch (lane_bytes) {
+    case 1: return _mm_sub_epi8(x, y);
+    case 2: return _mm_sub_epi16(x, y);
+    case 4: return _mm_sub_epi32(x, y);
+    default: return _mm_sub_epi64(x, y);
+    }
+}
+
+// one bit per lane out of the sign bit of each lane's top byte
+static inline uint32_t
+LaneMask(uint32_t byte_mask, uint8_t lane_bytes, int lane_base)
+{
+    uint32_t lane_mask = 0;
+    for (int lane = 0; lane < 16 / lane_bytes; lane++) {
+        if ((byte_mask >> (lane * lane_bytes + lane_bytes - 1)) & 1) {
+            lane_mask |= 1u << (lane_base + lane);
         }
+    }
+    return lane_mask;
+}
 
-        cout << "ip(" << hex << instr->ip << "):"
-             << "sub " << dec << GetOpndIntValue(srcOpnd0) << " "
-             << GetOpndIntValue(srcOpnd1) << " -> " << GetOpndIntValue(dstOpnd) << " "
-             << bitFlagsValue << endl;
+static inline int64_t
+LaneValue(const byte *vec, int lane, uint8_t lane_bytes)
+{
+    const byte *p = vec + lane * lane_bytes;
+    switch (lane_bytes) {
+    case 1: return *(const int8_t *)p;
+    case 2: return *(const int16_t *)p;
+    case 4: return *(const int32_t *)p;
+    default: return *(const int64_t *)p;
+    }
+}
 
+// Lost sources are rebuilt 16 bytes at a time, add: lost = r - other, sub: a = r + b,
+// b = a - r. Returns false if a source could not be read.
+static bool
+GetSimdOperands(simd_instr_t *simd, dr_mcontext_t *mc, byte *a, byte *b, byte *r)
+{
+    byte *src[2] = { a, b };
+    if (!reg_get_value_ex(simd->dst, mc, r)) {
+        return false;
     }
+    for (int i = 0; i < 2; i++) {
+        if (i != simd->lost_src && !ReadSimdOperand(simd->src[i], mc, simd->vec_bytes,
+                                                    src[i])) {
+            return false;
+        }
+    }
+    if (simd->lost_src == -1) {
+        return true;
+    }
+    uint8_t lane_bytes = simd->rule->lane_bytes;
+    bool is_sub = simd->rule->arith_rule == ARITH_RULE_SUB;
+    for (int off = 0; off < simd->vec_bytes; off += 16) {
+        __m128i vr = _mm_loadu_si128((const __m128i *)(r + off));
+        __m128i lost;
+        if (simd->lost_src == 0) {
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + off));
+            lost = is_sub ? LaneAdd(vr, vb, lane_bytes) : LaneSub(vr, vb, lane_bytes);
+            _mm_storeu_si128((__m128i *)(a + off), lost);
+        } else {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + off));
+            lost = is_sub ? LaneSub(va, vr, lane_bytes) : LaneSub(vr, va, lane_bytes);
+            _mm_storeu_si128((__m128i *)(b + off), lost);
+        }
+    }
+    return true;
+}
 
-    // shl: Destination = Source0 << Source1
-    if (opType == OperatorType::kOPshl) {
-        Operand srcOpnd0 = instr->getSrcOperand(0);
-        Operand srcOpnd1 = instr->getSrcOperand(1);
-        Operand dstOpnd = instr->getDstOperand(0);
-        std::bitset<64> bitFlagsValue(flagsValue);
+#if PROFILER_SIMD_KERNELS
+// add/sub: sign rule and carry/borrow out of the top bit on all lanes of 16 bytes at
+// once, as in Hacker's Delight 2-13
+static void
+SimdKernelMasks(simd_instr_t *simd, const byte *a, const byte *b, const byte *r,
+                uint32_t *signed_mask, uint32_t *unsigned_mask)
+{
+    uint8_t lane_bytes = simd->rule->lane_bytes;
+    bool is_sub = simd->rule->arith_rule == ARITH_RULE_SUB;
+    for (int off = 0; off < simd->vec_bytes; off += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + off));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + off));
+        __m128i vr = _mm_loadu_si128((const __m128i *)(r + off));
+        __m128i sov, uov;
+        if (is_sub) {
+            sov = _mm_and_si128(_mm_xor_si128(va, vb), _mm_xor_si128(va, vr));
+            // (~a & b) | (~(a ^ b) & r)
+            uov = _mm_or_si128(_mm_andnot_si128(va, vb),
+                               _mm_andnot_si128(_mm_xor_si128(va, vb), vr));
+        } else {
+            sov = _mm_and_si128(_mm_xor_si128(va, vr), _mm_xor_si128(vb, vr));
+            // (a & b) | ((a | b) & ~r)
+            uov = _mm_or_si128(_mm_and_si128(va, vb),
+                               _mm_andnot_si128(vr, _mm_or_si128(va, vb)));
+        }
+        int lane_base = off / lane_bytes;
+        *signed_mask |= LaneMask(_mm_movemask_epi8(sov), lane_bytes, lane_base);
+        *unsigned_mask |= LaneMask(_mm_movemask_epi8(uov), lane_bytes, lane_base);
+    }
+}
+#endif
 
-        if (IntegerOverflow(opType, flagsValue, srcOpnd0, srcOpnd1, dstOpnd)) {
-            ctxtContainer->addCtxt(contxt);
+// lane by lane with the scalar rule, shifts always go this way
+static void
+SimdScalarMasks(simd_instr_t *simd, const byte *a, const byte *b, const byte *r,
+                uint32_t *signed_mask, uint32_t *unsigned_mask)
+{
+    const arith_rule_t *rule = &arith_rules[simd->rule->arith_rule];
+    uint8_t lane_bytes = simd->rule->lane_bytes;
+    int width = WidthIndex(lane_bytes);
+    bool is_shift = simd->rule->arith_rule == ARITH_RULE_SHL;
+    // the count is the low quadword, the same for every lane. Unlike shl, packed shifts
+    // do not mask it: a count >= the lane width clears the lane, so any set bit is lost.
+    int64_t count = *(const int64_t *)b;
+    bool clears = is_shift && (uint64_t)count >= (uint64_t)lane_bytes * 8;
+    for (int lane = 0; lane < simd->vec_bytes / lane_bytes; lane++) {
+        int64_t a_val = LaneValue(a, lane, lane_bytes);
+        int64_t b_val = is_shift ? count : LaneValue(b, lane, lane_bytes);
+        int64_t r_val = LaneValue(r, lane, lane_bytes);
+        if (clears) {
+            if (a_val != 0) {
+                *signed_mask |= 1u << lane;
+                *unsigned_mask |= 1u << lane;
+            }
+            continue;
+        }
+        if (rule->signed_check[width](a_val, b_val, r_val)) {
+            *signed_mask |= 1u << lane;
+        }
+        if (rule->unsigned_check[width](a_val, b_val, r_val)) {
+            *unsigned_mask |= 1u << lane;
         }
+    }
+}
+
+static void
+CheckSimdOverflow(simd_instr_t *simd, context_handle_t contxt,
+                  CtxtContainer *ctxtContainer)
+{
+    void *drcontext = dr_get_current_drcontext();
+    dr_mcontext_t mc;
+    mc.size = sizeof(mc);
+    mc.flags = DR_MC_INTEGER | DR_MC_MULTIMEDIA;
+    if (!dr_get_mcontext(drcontext, &mc)) {
+        return;
+    }
+    byte a[32], b[32], r[32];
+    if (!GetSimdOperands(simd, &mc, a, b, r)) {
+        return;
+    }
+    uint32_t signed_mask = 0;
+    uint32_t unsigned_mask = 0;
+#if PROFILER_SIMD_KERNELS
+    if (simd->rule->arith_rule != ARITH_RULE_SHL) {
+        SimdKernelMasks(simd, a, b, r, &signed_mask, &unsigned_mask);
+    } else
+#endif
+    {
+        SimdScalarMasks(simd, a, b, r, &signed_mask, &unsigned_mask);
+    }
+#if !PROFILER_REPORT_WRAP
+    unsigned_mask = 0;
+#endif
+    uint32_t lane_mask = signed_mask | unsigned_mask;
+    if (lane_mask == 0) {
+        return;
+    }
+    int overflow_kind = (signed_mask != 0 ? OVERFLOW_SIGNED : 0) |
+        (unsigned_mask != 0 ? OVERFLOW_UNSIGNED : 0);
+    // the operands of the lowest overflowing lane
+    uint8_t lane_bytes = simd->rule->lane_bytes;
+    int lane = __builtin_ctz(lane_mask);
+    int64_t b_val = simd->rule->arith_rule == ARITH_RULE_SHL ? *(const int64_t *)b
+                                                             : LaneValue(b, lane, lane_bytes);
+    RecordOverflow(contxt, overflow_kind, LaneValue(a, lane, lane_bytes), b_val,
+                   LaneValue(r, lane, lane_bytes), lane_mask, lane_bytes, ctxtContainer);
+}
+
+#if PROFILER_TRACE_MODE == PROFILER_TRACE_BUFFER
+typedef struct _trace_record_t {
+    uint64_t ip;
+    int64_t src0;
+    int64_t src1;
+    int64_t dst;
+    uint64_t flags;
+    context_handle_t ctxt;
+    int32_t tid;
+    // index into arith_rules
+    uint8_t op;
+    uint8_t size;
+    // OVERFLOW_SIGNED / OVERFLOW_UNSIGNED bits
+    uint8_t overflow;
+    uint8_t reserved[5];
+} trace_record_t;
+
+#    define TRACE_RING_BITS 16
+#    define TRACE_RING_SIZE (1 << TRACE_RING_BITS)
+#    define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+#    define TRACE_WRITER_PERIOD_MS 10
+
+// Single producer (the owning thread), single consumer (the writer thread). A full
+// ring drops records instead of blocking the application.
+typedef struct _trace_ring_t {
+    trace_record_t *records;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;
+    struct _trace_ring_t *next;
+} trace_ring_t;
 
-        cout << "ip(" << hex << instr->ip << "):"
-             << "shl " << dec << GetOpndIntValue(srcOpnd0) << " "
-             << GetOpndIntValue(srcOpnd1) << " -> " << GetOpndIntValue(dstOpnd) << " "
-             << bitFlagsValue << endl;
+// rings are only freed by ExitTrace(), the writer walks the list without holding
+// trace_lock for the I/O
+static trace_ring_t *volatile trace_rings = NULL;
+static void *volatile trace_lock = NULL;
+static int trace_tls_idx = -1;
+static file_t trace_file = INVALID_FILE;
 
+// copies the filled part of ring into the trace file, tail follows every write so
+// that a chunk is never written twice
+static void
+DrainTraceRing(trace_ring_t *ring)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    while (tail != head) {
+        uint64_t start = tail & TRACE_RING_MASK;
+        uint64_t num = head - tail;
+        if (start + num > TRACE_RING_SIZE) {
+            num = TRACE_RING_SIZE - start;
+        }
+        dr_write_file(trace_file, ring->records + start, num * sizeof(trace_record_t));
+        tail += num;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
     }
 }
 
+static void
+TraceWriterThread(void *arg)
+{
+    for (;;) {
+        dr_sleep(TRACE_WRITER_PERIOD_MS);
+        // DR suspends client threads at exit, ExitTrace() must not find the writer
+        // between a write and the tail update
+        dr_client_thread_set_suspendable(false);
+        for (trace_ring_t *ring = trace_rings; ring != NULL; ring = ring->next) {
+            DrainTraceRing(ring);
+        }
+        dr_client_thread_set_suspendable(true);
+    }
+}
+
+// the first traced instruction sets up the TLS field, the trace file and the writer
+// thread
+static void
+InitTrace()
+{
+    dr_mutex_lock(GetLazyMutex(&trace_lock));
+    if (trace_tls_idx == -1) {
+        trace_file = dr_open_file("integer-overflow-trace.bin",
+                                  DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
+        DR_ASSERT(trace_file != INVALID_FILE);
+        dr_create_client_thread(TraceWriterThread, NULL);
+        __atomic_store_n(&trace_tls_idx, drmgr_register_tls_field(), __ATOMIC_RELEASE);
+    }
+    dr_mutex_unlock(trace_lock);
+}
+
+static trace_ring_t *
+GetTraceRing(void *drcontext)
+{
+    if (__atomic_load_n(&trace_tls_idx, __ATOMIC_ACQUIRE) == -1) {
+        InitTrace();
+    }
+    trace_ring_t *ring = (trace_ring_t *)drmgr_get_tls_field(drcontext, trace_tls_idx);
+    if (ring == NULL) {
+        ring = (trace_ring_t *)dr_global_alloc(sizeof(trace_ring_t));
+        ring->records = (trace_record_t *)dr_global_alloc(TRACE_RING_SIZE *
+                                                          sizeof(trace_record_t));
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        drmgr_set_tls_field(drcontext, trace_tls_idx, ring);
+        dr_mutex_lock(trace_lock);
+        ring->next = trace_rings;
+        trace_rings = ring;
+        dr_mutex_unlock(trace_lock);
+    }
+    return ring;
+}
+
+static inline void
+TraceRecord(uint8_t op, Instruction *instr, context_handle_t contxt, uint64_t flagsValue,
+            Operand src0, Operand src1, Operand dst, int overflow_kind)
+{
+    void *drcontext = dr_get_current_drcontext();
+    trace_ring_t *ring = GetTraceRing(drcontext);
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    trace_record_t *record = &ring->records[head & TRACE_RING_MASK];
+    record->ip = (uint64_t)instr->ip;
+    record->src0 = GetOpndIntValue(src0);
+    record->src1 = GetOpndIntValue(src1);
+    record->dst = GetOpndIntValue(dst);
+    record->flags = flagsValue;
+    record->ctxt = contxt;
+    record->tid = dr_get_thread_id(drcontext);
+    record->op = op;
+    record->size = dst.size;
+    record->overflow = overflow_kind;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// writer thread is suspended at exit, drain what is left and free the rings
+static void
+ExitTrace()
+{
+    if (trace_tls_idx == -1) {
+        return;
+    }
+    uint64_t dropped = 0;
+    trace_ring_t *ring = trace_rings;
+    trace_rings = NULL;
+    while (ring != NULL) {
+        DrainTraceRing(ring);
+        dropped += ring->dropped;
+        trace_ring_t *next = ring->next;
+        dr_global_free(ring->records, TRACE_RING_SIZE * sizeof(trace_record_t));
+        dr_global_free(ring, sizeof(trace_ring_t));
+        ring = next;
+    }
+    dr_close_file(trace_file);
+    if (dropped > 0) {
+        dr_fprintf(STDERR, "integer overflow trace: %llu records dropped\n", dropped);
+    }
+}
+#endif
+
+#if PROFILER_VALUE_RANGE
+// signed headroom buckets: 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63 bits
+#    define RANGE_BUCKET_NUM 7
+
+typedef struct _range_stat_t {
+    uint64_t count;
+    int64_t min;
+    int64_t max;
+    // bits left before the result overflows as signed / wraps as unsigned
+    uint8_t min_headroom;
+    uint8_t min_unsigned_headroom;
+    uint64_t headroom_hist[RANGE_BUCKET_NUM];
+} range_stat_t;
+
+typedef std::unordered_map<context_handle_t, range_stat_t> range_table_t;
+
+// one table per thread, merged at exit, so recording takes no lock
+static std::vector<range_table_t *> *range_tables = NULL;
+static void *volatile range_lock = NULL;
+static int range_tls_idx = -1;
+
+static range_table_t *
+GetRangeTable()
+{
+    if (__atomic_load_n(&range_tls_idx, __ATOMIC_ACQUIRE) == -1) {
+        dr_mutex_lock(GetLazyMutex(&range_lock));
+        if (range_tls_idx == -1) {
+            range_tables = new std::vector<range_table_t *>();
+            __atomic_store_n(&range_tls_idx, drmgr_register_tls_field(), __ATOMIC_RELEASE);
+        }
+        dr_mutex_unlock(range_lock);
+    }
+    void *drcontext = dr_get_current_drcontext();
+    range_table_t *table = (range_table_t *)drmgr_get_tls_field(drcontext, range_tls_idx);
+    if (table == NULL) {
+        table = new range_table_t();
+        drmgr_set_tls_field(drcontext, range_tls_idx, table);
+        dr_mutex_lock(range_lock);
+        range_tables->push_back(table);
+        dr_mutex_unlock(range_lock);
+    }
+    return table;
+}
+
+// free bits of a bits wide field holding magnitude
+static inline uint8_t
+Headroom(uint64_t magnitude, int bits)
+{
+    int used = magnitude == 0 ? 0 : 64 - __builtin_clzll(magnitude);
+    return (uint8_t)(bits - used);
+}
+
+static inline void
+RecordValueRange(context_handle_t contxt, Operand dst)
+{
+    if (WidthIndex(dst.size) < 0) {
+        return;
+    }
+    int bits = dst.size * 8;
+    int64_t value = GetOpndIntValue(dst);
+    // the sign bit is no headroom
+    uint8_t headroom = Headroom(value < 0 ? ~(uint64_t)value : (uint64_t)value, bits - 1);
+    uint8_t unsigned_headroom = Headroom((uint64_t)value & (~0ull >> (64 - bits)), bits);
+
+    range_table_t *table = GetRangeTable();
+    auto it = table->find(contxt);
+    if (it == table->end()) {
+        range_stat_t stat;
+        memset(&stat, 0, sizeof(stat));
+        stat.min = value;
+        stat.max = value;
+        stat.min_headroom = headroom;
+        stat.min_unsigned_headroom = unsigned_headroom;
+        it = table->emplace(contxt, stat).first;
+    }
+    range_stat_t &stat = it->second;
+    stat.count++;
+    stat.min = std::min(stat.min, value);
+    stat.max = std::max(stat.max, value);
+    stat.min_headroom = std::min(stat.min_headroom, headroom);
+    stat.min_unsigned_headroom = std::min(stat.min_unsigned_headroom, unsigned_headroom);
+    stat.headroom_hist[headroom == 0 ? 0 : 32 - __builtin_clz(headroom)]++;
+}
+
+// the threads' tables folded into one, the per-thread ones are freed
+static void
+MergeRangeTables(range_table_t *merged)
+{
+    if (range_tables == NULL) {
+        return;
+    }
+    for (range_table_t *table : *range_tables) {
+        for (auto &entry : *table) {
+            const range_stat_t &stat = entry.second;
+            auto it = merged->find(entry.first);
+            if (it == merged->end()) {
+                merged->emplace(entry.first, stat);
+                continue;
+            }
+            range_stat_t &total = it->second;
+            total.count += stat.count;
+            total.min = std::min(total.min, stat.min);
+            total.max = std::max(total.max, stat.max);
+            total.min_headroom = std::min(total.min_headroom, stat.min_headroom);
+            total.min_unsigned_headroom =
+                std::min(total.min_unsigned_headroom, stat.min_unsigned_headroom);
+            for (int i = 0; i < RANGE_BUCKET_NUM; i++) {
+                total.headroom_hist[i] += stat.headroom_hist[i];
+            }
+        }
+        delete table;
+    }
+    delete range_tables;
+    range_tables = NULL;
+}
+
+static const char *range_metric_names[] = {
+    "executions",
+    "min result",
+    "max result",
+    "min signed headroom (bits)",
+    "min unsigned headroom (bits)",
+    "signed headroom 0 bits",
+    "signed headroom 1 bit",
+    "signed headroom 2-3 bits",
+    "signed headroom 4-7 bits",
+    "signed headroom 8-15 bits",
+    "signed headroom 16-31 bits",
+    "signed headroom 32-63 bits",
+};
+
+// zeros for a context without range statistics
+static void
+AppendRangeMetrics(Profile::sample_t *sample, const range_stat_t *stat)
+{
+    range_stat_t empty;
+    if (stat == NULL) {
+        memset(&empty, 0, sizeof(empty));
+        stat = &empty;
+    }
+    sample->append_metirc(stat->count);
+    sample->append_metirc(stat->min);
+    sample->append_metirc(stat->max);
+    sample->append_metirc((uint64_t)stat->min_headroom);
+    sample->append_metirc((uint64_t)stat->min_unsigned_headroom);
+    for (int i = 0; i < RANGE_BUCKET_NUM; i++) {
+        sample->append_metirc(stat->headroom_hist[i]);
+    }
+}
+#endif
+
+// false when the flags already rule out an overflow
+static inline bool
+NeedsOverflowCheck(const arith_rule_t *rule, uint64_t flagsValue)
+{
+#if PROFILER_FLAGS_FILTER
+    uint64_t flags_mask = rule->flags_mask;
+#    if !PROFILER_REPORT_WRAP
+    // CF only reports the unsigned wraparound
+    flags_mask &= ~(uint64_t)EFLAGS_CF;
+#    endif
+    if (flags_mask != 0) {
+        return (flagsValue & flags_mask) != 0;
+    }
+#endif
+    return true;
+}
+
+void
+OnAfterInsExec(Instruction *instr, context_handle_t contxt, uint64_t flagsValue,
+                        CtxtContainer *ctxtContainer)
+{
+    // Destination = Source0 op Source1, see arith_rules
+    simd_instr_t *simd = NULL;
+    int32_t rule_idx = GetInstrRule(instr, &simd);
+    if (rule_idx == RULE_SIMD) {
+        CheckSimdOverflow(simd, contxt, ctxtContainer);
+        return;
+    }
+    if (rule_idx < 0) {
+        return;
+    }
+    const arith_rule_t *rule = &arith_rules[rule_idx];
+    bool needs_check = NeedsOverflowCheck(rule, flagsValue);
+#if PROFILER_TRACE_MODE == PROFILER_TRACE_OFF && !PROFILER_VALUE_RANGE
+    // common case: no operand is decoded
+    if (!needs_check) {
+        return;
+    }
+#endif
+    Operand srcOpnd0 = instr->getSrcOperand(0);
+    Operand srcOpnd1 = instr->getSrcOperand(1);
+    Operand dstOpnd = instr->getDstOperand(0);
+#if PROFILER_VALUE_RANGE
+    RecordValueRange(contxt, dstOpnd);
+#endif
+
+    int overflow_kind = needs_check ? IntegerOverflow(rule, srcOpnd0, srcOpnd1, dstOpnd) : 0;
+    if (overflow_kind != 0) {
+        RecordOverflow(contxt, overflow_kind, GetOpndIntValue(srcOpnd0),
+                       GetOpndIntValue(srcOpnd1), GetOpndIntValue(dstOpnd), 0, 0,
+                       ctxtContainer);
+    }
+
+#if PROFILER_TRACE_MODE == PROFILER_TRACE_BUFFER
+    TraceRecord((uint8_t)(rule - arith_rules), instr, contxt, flagsValue, srcOpnd0,
+                srcOpnd1, dstOpnd, overflow_kind);
+#elif PROFILER_TRACE_MODE == PROFILER_TRACE_CONSOLE
+    std::bitset<64> bitFlagsValue(flagsValue);
+    cout << "ip(" << hex << instr->ip << "):" << rule->name << " " << dec
+         << GetOpndIntValue(srcOpnd0) << " " << GetOpndIntValue(srcOpnd1) << " -> "
+         << GetOpndIntValue(dstOpnd) << " " << bitFlagsValue << endl;
+#endif
+}
+
 void
 OnBeforeAppExit(CtxtContainer *ctxtContainer)
 {
+#if PROFILER_TRACE_MODE == PROFILER_TRACE_BUFFER
+    ExitTrace();
+#endif
+    FreeRuleCache();
+    // signed overflows first, most frequent first, then the contexts that only wrapped
+    overflow_table_t overflows;
+    MergeOverflowTables(&overflows);
+    std::vector<std::pair<context_handle_t, overflow_stat_t>> stats(overflows.begin(),
+                                                                     overflows.end());
+    std::sort(stats.begin(), stats.end(),
+              [](const std::pair<context_handle_t, overflow_stat_t> &a,
+                 const std::pair<context_handle_t, overflow_stat_t> &b) {
+                  if (a.second.count != b.second.count) {
+                      return a.second.count > b.second.count;
+                  }
+                  if (a.second.wrap_count != b.second.wrap_count) {
+                      return a.second.wrap_count > b.second.wrap_count;
+                  }
+                  return a.first < b.first;
+              });
+
     Profile::profile_t *profile = new Profile::profile_t();
     profile->add_metric_type(1, "", "integer overflow occurrence");
+    profile->add_metric_type(1, "", "unsigned wraparound occurrence");
+#if PROFILER_VALUE_RANGE
+    range_table_t ranges;
+    MergeRangeTables(&ranges);
+    for (const char *name : range_metric_names) {
+        profile->add_metric_type(1, "", name);
+    }
+#endif
 
-    std::vector<context_handle_t> list = ctxtContainer->getCtxtList();
-    for (size_t i = 0; i < list.size(); i++) {
-        inner_context_t *cur_ctxt = drcctlib_get_full_cct(list[i]);
-        profile->add_sample(cur_ctxt)->append_metirc((uint64_t)1);
+    for (size_t i = 0; i < stats.size(); i++) {
+        inner_context_t *cur_ctxt = drcctlib_get_full_cct(stats[i].first);
+        Profile::sample_t *sample = profile->add_sample(cur_ctxt);
+        sample->append_metirc(stats[i].second.count);
+        sample->append_metirc(stats[i].second.wrap_count);
+#if PROFILER_VALUE_RANGE
+        auto range = ranges.find(stats[i].first);
+        if (range != ranges.end()) {
+            AppendRangeMetrics(sample, &range->second);
+            ranges.erase(range);
+        } else {
+            AppendRangeMetrics(sample, NULL);
+        }
+#endif
         drcctlib_free_full_cct(cur_ctxt);
     }
+#if PROFILER_VALUE_RANGE
+    // contexts that never overflowed
+    for (auto &range : ranges) {
+        inner_context_t *cur_ctxt = drcctlib_get_full_cct(range.first);
+        Profile::sample_t *sample = profile->add_sample(cur_ctxt);
+        sample->append_metirc((uint64_t)0);
+        sample->append_metirc((uint64_t)0);
+        AppendRangeMetrics(sample, &range.second);
+        drcctlib_free_full_cct(cur_ctxt);
+    }
+#endif
     profile->serialize_to_file("integer-overflow-profile.drcctprof");
     delete profile;
 
     file_t profileTxt = dr_open_file("integer-overflow-profile.txt",
                                      DR_FILE_WRITE_OVERWRITE | DR_FILE_ALLOW_LARGE);
     DR_ASSERT(profileTxt != INVALID_FILE);
-    for (size_t i = 0; i < list.size(); i++) {
-        dr_fprintf(profileTxt, "INTEGER OVERFLOW\n");
-        drcctlib_print_backtrace_first_item(profileTxt, list[i], true, false);
+    dr_fprintf(profileTxt,
+               "CHECKED INSTRUCTIONS %llu\n"
+               "CHECK SKIPPED INSTRUCTIONS %llu (pruned, still instrumented)\n"
+               "PACKED INSTRUCTIONS %llu\n\n",
+               checked_instr_num, skipped_instr_num, packed_instr_num);
+    for (size_t i = 0; i < stats.size(); i++) {
+        const overflow_stat_t &stat = stats[i].second;
+        dr_fprintf(profileTxt,
+                   stat.count > 0 ? "INTEGER OVERFLOW\n" : "UNSIGNED WRAPAROUND\n");
+        drcctlib_print_backtrace_first_item(profileTxt, stats[i].first, true, false);
+        dr_fprintf(profileTxt, "=>OCCURRENCES\n%llu\n", stat.count);
+#if PROFILER_REPORT_WRAP
+        dr_fprintf(profileTxt, "=>UNSIGNED WRAPAROUNDS\n%llu\n", stat.wrap_count);
+#endif
+        if (stat.lane_bytes != 0) {
+            dr_fprintf(profileTxt, "=>LANES (%d-bit)\n", stat.lane_bytes * 8);
+            for (int lane = 0; lane < 32; lane++) {
+                if ((stat.lane_mask >> lane) & 1) {
+                    dr_fprintf(profileTxt, "%d ", lane);
+                }
+            }
+            dr_fprintf(profileTxt, "\n");
+        }
+        dr_fprintf(profileTxt, "=>FIRST\n%lld %lld -> %lld\n", stat.first_operands[0],
+                   stat.first_operands[1], stat.first_operands[2]);
+        dr_fprintf(profileTxt, "=>LAST\n%lld %lld -> %lld\n", stat.last_operands[0],
+                   stat.last_operands[1], stat.last_operands[2]);
         dr_fprintf(profileTxt, "=>BACKTRACE\n");
-        drcctlib_print_backtrace(profileTxt, list[i], false, true, -1);
+        drcctlib_print_backtrace(profileTxt, stats[i].first, false, true, -1);
         dr_fprintf(profileTxt, "\n\n");
     }
     dr_close_file(profileTxt);
@@ -46,19 +46,21 @@ IntegerOverflow(OperatorType opType, uint64_t flagsValue, Operand src1, Operand
     int64_t src1_val = GetOpndIntValue(src1);
     int64_t src2_val = GetOpndIntValue(src2);
     if (opType == OperatorType::kOPadd) {
+        // EFLAGS_OF is the OF bit of the flags register, EFLAGS_READ_OF is not
         bool is_overflow = false;
-        if((flagsValue & EFLAGS_READ_OF) != 0)
-            is_overflow = false;
+        if((flagsValue & EFLAGS_OF) != 0)
+            is_overflow = true;
         return is_overflow;
     } else if (opType == OperatorType::kOPsub) {
         bool is_overflow = false;
-        if((flagsValue & EFLAGS_READ_OF) != 0)
-            is_overflow = false;
+        if((flagsValue & EFLAGS_OF) != 0)
+            is_overflow = true;
         return is_overflow;
     } else if (opType == OperatorType::kOPshl) {
+        // OF is only defined for 1-bit shifts
         bool is_overflow = false;
-        if((flagsValue & EFLAGS_READ_OF) != 0)
-            is_overflow = false;
+        if(GetOpndIntValue(src2) == 1 && (flagsValue & EFLAGS_OF) != 0)
+            is_overflow = true;
         return is_overflow;
     } else {
         return false;
@@ -0,0 +1,24 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+// Workload for bench_simd.sh: loops the compiler vectorizes into paddd/psubd (vpaddd/
+// vpsubd with -mavx2), one element in 1000 overflows. argv[1] is the round count.
+#define N 4096
+static int a[N], b[N], c[N];
+int main(int argc, char *argv[]){
+    long n = argc > 1 ? atol(argv[1]) : 10000;
+    for(int i = 0; i < N; i++){
+        a[i] = (i % 1000 == 0) ? INT_MAX : i;
+        b[i] = 1;
+    }
+    long sum = 0;
+    for(long round = 0; round < n; round++){
+        for(int i = 0; i < N; i++)
+            c[i] = a[i] + b[i];
+        for(int i = 0; i < N; i++)
+            c[i] = c[i] - a[i];
+        sum += c[round % N];
+    }
+    printf("%ld\n", sum);
+    return 0;
+}
@@ -0,0 +1,26 @@
+# Prints integer-overflow-trace.bin, written with PROFILER_TRACE_MODE=1, in the line
+# format of the old console trace.
+#
+#   python3 trace_view.py integer-overflow-trace.bin [-overflow]
+
+import struct, sys
+
+RECORD = struct.Struct( "<QqqqQiiBBB5x" )
+# order of arith_rules in profiler.cpp
+OPS = [ "add", "sub", "shl", "imul", "inc", "dec", "neg", "adc", "sbb" ]
+
+def main( ):
+	if len( sys.argv ) < 2:
+		sys.exit( "usage: trace_view.py <trace> [-overflow]" )
+	only_overflow = "-overflow" in sys.argv[ 2: ]
+	data = open( sys.argv[ 1 ], "rb" ).read( )
+	for offset in range( 0, len( data ) - RECORD.size + 1, RECORD.size ):
+		ip, src0, src1, dst, flags, ctxt, tid, op, size, overflow = RECORD.unpack_from( data, offset )
+		if only_overflow and not overflow:
+			continue
+		print( "tid(%d) ctxt(%d) ip(%x):%s %d %d -> %d %s%s" % ( tid, ctxt, ip,
+			OPS[ op ] if op < len( OPS ) else str( op ), src0, src1, dst,
+			format( flags, "064b" ), ( " OVERFLOW" if overflow & 1 else "" ) +
+			( " WRAP" if overflow & 2 else "" ) ) )
+
+main( )